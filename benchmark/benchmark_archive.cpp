@@ -0,0 +1,105 @@
+#include "utils.hpp"
+
+#include <immer-archive/champ/traits.hpp>
+#include <immer-archive/json/archivable.hpp>
+#include <immer-archive/json/json_with_archive.hpp>
+#include <immer-archive/rbts/traits.hpp>
+
+#include <boost/hana.hpp>
+
+#include <cereal/types/vector.hpp>
+
+namespace {
+
+namespace hana = boost::hana;
+
+/**
+ * A user type whose containers are saved into the archives, to measure
+ * to_json_with_archive and from_json_with_archive from end to end.
+ */
+struct document
+{
+    immer_archive::archivable<immer::vector<int>> values;
+    immer_archive::archivable<immer::map<int, std::string>> names;
+
+    template <class Archive>
+    void serialize(Archive& ar)
+    {
+        ar(CEREAL_NVP(values), CEREAL_NVP(names));
+    }
+};
+
+inline auto get_archives_types(const std::vector<document>&)
+{
+    return hana::make_map(
+        hana::make_pair(hana::type_c<immer::vector<int>>,
+                        BOOST_HANA_STRING("values")),
+        hana::make_pair(hana::type_c<immer::map<int, std::string>>,
+                        BOOST_HANA_STRING("names")));
+}
+
+std::vector<document> make_documents(const benchmark::State& state)
+{
+    const auto values = bench::make_containers<immer::vector<int>>(
+        state,
+        [](immer::vector<int> vec, std::size_t index) {
+            return std::move(vec).push_back(bench::make_value<int>(index));
+        },
+        [](immer::vector<int> vec,
+           std::size_t position,
+           std::size_t /* old_index */,
+           std::size_t new_index) {
+            return std::move(vec).set(position,
+                                      bench::make_value<int>(new_index));
+        });
+    const auto names = bench::make_containers<immer::map<int, std::string>>(
+        state,
+        [](immer::map<int, std::string> map, std::size_t index) {
+            return std::move(map).set(
+                bench::make_value<int>(index),
+                bench::make_value<std::string>(index));
+        },
+        [](immer::map<int, std::string> map,
+           std::size_t position,
+           std::size_t /* old_index */,
+           std::size_t new_index) {
+            return std::move(map).set(
+                bench::make_value<int>(position),
+                bench::make_value<std::string>(new_index));
+        });
+
+    auto result = std::vector<document>{};
+    for (auto index = std::size_t{}; index < bench::containers_count;
+         ++index) {
+        result.push_back(document{values[index], names[index]});
+    }
+    return result;
+}
+
+void to_json_with_archive(benchmark::State& state)
+{
+    const auto documents = make_documents(state);
+    auto json            = std::string{};
+    for (auto _ : state) {
+        json = immer_archive::to_json_with_archive(documents).first;
+        benchmark::DoNotOptimize(json);
+    }
+    bench::report(state, json.size());
+}
+
+void from_json_with_archive(benchmark::State& state)
+{
+    const auto json =
+        immer_archive::to_json_with_archive(make_documents(state)).first;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            immer_archive::from_json_with_archive<std::vector<document>>(
+                json));
+    }
+    bench::report(state, json.size());
+}
+
+BENCHMARK(to_json_with_archive)->Apply(bench::sizes_and_sharing);
+BENCHMARK(from_json_with_archive)->Apply(bench::sizes_and_sharing);
+
+} // namespace
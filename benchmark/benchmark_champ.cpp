@@ -0,0 +1,175 @@
+#include "utils.hpp"
+
+#include <immer-archive/champ/champ.hpp>
+
+#include <immer/map.hpp>
+#include <immer/set.hpp>
+#include <immer/table.hpp>
+
+namespace {
+
+using immer_archive::node_id;
+
+struct record
+{
+    std::size_t id;
+    std::string value;
+
+    friend bool operator==(const record& left, const record& right)
+    {
+        return left.id == right.id && left.value == right.value;
+    }
+
+    template <class Archive>
+    void serialize(Archive& ar)
+    {
+        ar(CEREAL_NVP(id), CEREAL_NVP(value));
+    }
+};
+
+template <class Container>
+struct generator;
+
+template <class K, class V>
+struct generator<immer::map<K, V>>
+{
+    static auto add(immer::map<K, V> map, std::size_t index)
+    {
+        return std::move(map).set(bench::make_value<K>(index),
+                                  bench::make_value<V>(index));
+    }
+
+    static auto replace(immer::map<K, V> map,
+                        std::size_t position,
+                        std::size_t /* old_index */,
+                        std::size_t new_index)
+    {
+        return std::move(map).set(bench::make_value<K>(position),
+                                  bench::make_value<V>(new_index));
+    }
+};
+
+template <class T>
+struct generator<immer::set<T>>
+{
+    static auto add(immer::set<T> set, std::size_t index)
+    {
+        return std::move(set).insert(bench::make_value<T>(index));
+    }
+
+    static auto replace(immer::set<T> set,
+                        std::size_t /* position */,
+                        std::size_t old_index,
+                        std::size_t new_index)
+    {
+        return std::move(set)
+            .erase(bench::make_value<T>(old_index))
+            .insert(bench::make_value<T>(new_index));
+    }
+};
+
+template <>
+struct generator<immer::table<record>>
+{
+    static auto add(immer::table<record> table, std::size_t index)
+    {
+        return std::move(table).insert(
+            record{index, bench::make_value<std::string>(index)});
+    }
+
+    static auto replace(immer::table<record> table,
+                        std::size_t position,
+                        std::size_t /* old_index */,
+                        std::size_t new_index)
+    {
+        return std::move(table).insert(
+            record{position, bench::make_value<std::string>(new_index)});
+    }
+};
+
+template <class Container>
+std::vector<Container> make_champs(const benchmark::State& state)
+{
+    return bench::make_containers<Container>(
+        state, generator<Container>::add, generator<Container>::replace);
+}
+
+template <class Container>
+auto save_champs(const std::vector<Container>& containers)
+{
+    auto archive = immer_archive::champ::container_archive_save<Container>{};
+    auto ids     = std::vector<node_id>{};
+    for (const auto& container : containers) {
+        auto [archive2, id] = immer_archive::champ::save_to_archive(
+            container, std::move(archive));
+        archive = std::move(archive2);
+        ids.push_back(id);
+    }
+    return std::make_pair(std::move(archive), std::move(ids));
+}
+
+template <class Container>
+using archive_load_t = immer_archive::champ::container_archive_load<Container>;
+
+template <class Container>
+void save(benchmark::State& state)
+{
+    const auto containers = make_champs<Container>(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(save_champs(containers));
+    }
+    bench::report(state, bench::to_json(save_champs(containers).first).size());
+}
+
+template <class Container>
+void serialize(benchmark::State& state)
+{
+    const auto archive = save_champs(make_champs<Container>(state)).first;
+    auto json          = std::string{};
+    for (auto _ : state) {
+        json = bench::to_json(archive);
+        benchmark::DoNotOptimize(json);
+    }
+    bench::report(state, json.size());
+}
+
+template <class Container>
+void parse(benchmark::State& state)
+{
+    const auto json =
+        bench::to_json(save_champs(make_champs<Container>(state)).first);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            bench::from_json<archive_load_t<Container>>(json));
+    }
+    bench::report(state, json.size());
+}
+
+template <class Container>
+void load(benchmark::State& state)
+{
+    const auto [archive, ids] = save_champs(make_champs<Container>(state));
+    const auto json           = bench::to_json(archive);
+    const auto loaded = bench::from_json<archive_load_t<Container>>(json);
+    for (auto _ : state) {
+        auto loader = immer_archive::champ::container_loader{loaded};
+        for (const auto& id : ids) {
+            benchmark::DoNotOptimize(loader.load(id));
+        }
+    }
+    bench::report(state, json.size());
+}
+
+#define CHAMP_BENCHMARKS(...)                                                  \
+    BENCHMARK(save<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);             \
+    BENCHMARK(serialize<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);        \
+    BENCHMARK(parse<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);            \
+    BENCHMARK(load<__VA_ARGS__>)->Apply(bench::sizes_and_sharing)
+
+CHAMP_BENCHMARKS(immer::map<int, int>);
+CHAMP_BENCHMARKS(immer::map<int, std::string>);
+CHAMP_BENCHMARKS(immer::set<int>);
+CHAMP_BENCHMARKS(immer::set<std::string>);
+CHAMP_BENCHMARKS(immer::table<record>);
+
+} // namespace
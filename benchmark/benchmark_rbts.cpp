@@ -0,0 +1,110 @@
+#include "utils.hpp"
+
+#include <immer-archive/rbts/load.hpp>
+#include <immer-archive/rbts/save.hpp>
+
+#include <immer/flex_vector.hpp>
+#include <immer/vector.hpp>
+
+namespace {
+
+using immer_archive::container_id;
+
+template <class Container>
+std::vector<Container> make_vectors(const benchmark::State& state)
+{
+    using T = typename Container::value_type;
+    return bench::make_containers<Container>(
+        state,
+        [](Container vec, std::size_t index) {
+            return std::move(vec).push_back(bench::make_value<T>(index));
+        },
+        [](Container vec,
+           std::size_t position,
+           std::size_t /* old_index */,
+           std::size_t new_index) {
+            return std::move(vec).set(position,
+                                      bench::make_value<T>(new_index));
+        });
+}
+
+template <class Container>
+auto save_vectors(const std::vector<Container>& vectors)
+{
+    auto archive = immer_archive::rbts::make_save_archive_for(Container{});
+    auto ids     = std::vector<container_id>{};
+    for (const auto& vec : vectors) {
+        auto [archive2, id] =
+            immer_archive::rbts::save_to_archive(vec, std::move(archive));
+        archive = std::move(archive2);
+        ids.push_back(id);
+    }
+    return std::make_pair(std::move(archive), std::move(ids));
+}
+
+template <class Container>
+using archive_load_t =
+    immer_archive::rbts::archive_load<typename Container::value_type>;
+
+template <class Container>
+void save(benchmark::State& state)
+{
+    const auto vectors = make_vectors<Container>(state);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(save_vectors(vectors));
+    }
+    bench::report(state, bench::to_json(save_vectors(vectors).first).size());
+}
+
+template <class Container>
+void serialize(benchmark::State& state)
+{
+    const auto archive = save_vectors(make_vectors<Container>(state)).first;
+    auto json          = std::string{};
+    for (auto _ : state) {
+        json = bench::to_json(archive);
+        benchmark::DoNotOptimize(json);
+    }
+    bench::report(state, json.size());
+}
+
+template <class Container>
+void parse(benchmark::State& state)
+{
+    const auto json = bench::to_json(
+        save_vectors(make_vectors<Container>(state)).first);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(
+            bench::from_json<archive_load_t<Container>>(json));
+    }
+    bench::report(state, json.size());
+}
+
+template <class Container>
+void load(benchmark::State& state)
+{
+    const auto [archive, ids] = save_vectors(make_vectors<Container>(state));
+    const auto json           = bench::to_json(archive);
+    const auto loaded = bench::from_json<archive_load_t<Container>>(json);
+    for (auto _ : state) {
+        auto loader =
+            immer_archive::rbts::make_loader_for(Container{}, loaded);
+        for (const auto& id : ids) {
+            benchmark::DoNotOptimize(loader.load(id));
+        }
+    }
+    bench::report(state, json.size());
+}
+
+#define RBTS_BENCHMARKS(...)                                                   \
+    BENCHMARK(save<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);             \
+    BENCHMARK(serialize<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);        \
+    BENCHMARK(parse<__VA_ARGS__>)->Apply(bench::sizes_and_sharing);            \
+    BENCHMARK(load<__VA_ARGS__>)->Apply(bench::sizes_and_sharing)
+
+RBTS_BENCHMARKS(immer::vector<int>);
+RBTS_BENCHMARKS(immer::vector<std::string>);
+RBTS_BENCHMARKS(immer::flex_vector<int>);
+RBTS_BENCHMARKS(immer::flex_vector<std::string>);
+
+} // namespace
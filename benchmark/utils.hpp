@@ -0,0 +1,143 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cereal/archives/json.hpp>
+#include <cereal/types/string.hpp>
+
+#include <fmt/format.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+namespace bench {
+
+/**
+ * Every benchmark saves this many containers into one archive, each one
+ * derived from the previous one.
+ */
+constexpr auto containers_count = std::size_t{4};
+
+/**
+ * Element counts from 1e2 to 1e7, and the percentage of the elements that a
+ * container shares with the previous one.
+ */
+inline void sizes_and_sharing(benchmark::internal::Benchmark* b)
+{
+    for (auto count = std::int64_t{100}; count <= 10'000'000; count *= 10) {
+        for (const auto sharing : {0, 50, 90}) {
+            b->Args({count, sharing});
+        }
+    }
+    b->ArgNames({"elements", "sharing"});
+    b->Unit(benchmark::kMillisecond);
+}
+
+template <class T>
+T make_value(std::size_t index);
+
+template <>
+inline int make_value<int>(std::size_t index)
+{
+    return static_cast<int>(index);
+}
+
+template <>
+inline std::string make_value<std::string>(std::size_t index)
+{
+    return fmt::format("value_{}", index);
+}
+
+/**
+ * Build the first container with add(container, index) and derive each next
+ * one by replacing a part of the elements, using
+ * replace(container, position, old_index, new_index).
+ */
+template <class Container, class Add, class Replace>
+std::vector<Container> make_containers(const benchmark::State& state,
+                                       Add add,
+                                       Replace replace)
+{
+    const auto count   = static_cast<std::size_t>(state.range(0));
+    const auto sharing = static_cast<std::size_t>(state.range(1));
+    const auto changed = count * (100 - sharing) / 100;
+
+    auto container = Container{};
+    for (auto index = std::size_t{}; index < count; ++index) {
+        container = add(std::move(container), index);
+    }
+
+    auto result = std::vector<Container>{container};
+    for (auto generation = std::size_t{1}; generation < containers_count;
+         ++generation) {
+        for (auto i = std::size_t{}; i < changed; ++i) {
+            const auto position = i * count / changed;
+            container           = replace(std::move(container),
+                                position,
+                                (generation - 1) * count + position,
+                                generation * count + position);
+        }
+        result.push_back(container);
+    }
+    return result;
+}
+
+/**
+ * Linux reports the peak resident set size in kilobytes. It's the peak of the
+ * whole process, run one benchmark at a time with --benchmark_filter to
+ * attribute it to that benchmark.
+ */
+inline double peak_rss_bytes()
+{
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_maxrss) * 1024;
+}
+
+/**
+ * Report the time per element, the serialized bytes per element and the peak
+ * RSS for the stage that was just measured.
+ */
+inline void report(benchmark::State& state, std::size_t bytes)
+{
+    const auto elements =
+        static_cast<double>(state.range(0) * containers_count);
+    state.SetItemsProcessed(static_cast<std::int64_t>(
+        static_cast<double>(state.iterations()) * elements));
+    state.counters["time/element"] = benchmark::Counter{
+        elements,
+        benchmark::Counter::kIsIterationInvariantRate |
+            benchmark::Counter::kInvert};
+    state.counters["bytes/element"] =
+        benchmark::Counter{static_cast<double>(bytes) / elements};
+    state.counters["peak_rss"] =
+        benchmark::Counter{peak_rss_bytes(),
+                           benchmark::Counter::kDefaults,
+                           benchmark::Counter::OneK::kIs1024};
+}
+
+template <typename T>
+std::string to_json(const T& serializable)
+{
+    auto os = std::ostringstream{};
+    {
+        auto ar = cereal::JSONOutputArchive{os};
+        ar(serializable);
+    }
+    return os.str();
+}
+
+template <typename T>
+T from_json(const std::string& input)
+{
+    auto is = std::istringstream{input};
+    auto ar = cereal::JSONInputArchive{is};
+    auto r  = T{};
+    ar(r);
+    return r;
+}
+
+} // namespace bench
@@ -95,6 +95,7 @@
             # Build-time
             cmake
             ninja
+            gbenchmark
           ]
           ++ lib.optionals stdenv.isLinux [
             valgrind
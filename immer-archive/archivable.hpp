@@ -0,0 +1,100 @@
+#pragma once
+
+#include <immer-archive/errors.hpp>
+#include <immer-archive/traits.hpp>
+
+#include <cereal/cereal.hpp>
+
+#include <fmt/format.h>
+
+namespace immer_archive {
+
+template <class Container>
+struct archivable
+{
+    Container container;
+
+    archivable() = default;
+
+    archivable(std::initializer_list<typename Container::value_type> values)
+        : container{std::move(values)}
+    {
+    }
+
+    archivable(Container container_)
+        : container{std::move(container_)}
+    {
+    }
+
+    friend bool operator==(const archivable& left, const archivable& right)
+    {
+        return left.container == right.container;
+    }
+
+    friend auto begin(const archivable& value)
+    {
+        return value.container.begin();
+    }
+
+    friend auto end(const archivable& value) { return value.container.end(); }
+};
+
+namespace detail {
+
+/**
+ * Save the container into its archive and return the ID to be serialized in
+ * its place. Shared by all the archive types that carry immer archives.
+ */
+template <class SaveArchives, class Container>
+auto save_archivable(SaveArchives& archives, const archivable<Container>& value)
+{
+    auto& save_archive = archives.template get_save_archive<Container>();
+    auto [archive, id] =
+        save_to_archive(value.container, std::move(save_archive));
+    save_archive = std::move(archive);
+    return id.value;
+}
+
+template <class Loader, class Container>
+void load_archivable(
+    Loader& loader,
+    archivable<Container>& value,
+    const typename container_traits<Container>::container_id::rep_t& id)
+{
+    // Have to be specific because for vectors container_id is different from
+    // node_id, but for hash-based containers, a container is identified just by
+    // its root node.
+    using container_id_ = typename container_traits<Container>::container_id;
+
+    try {
+        value.container = loader.load(container_id_{id});
+    } catch (const archive_exception& ex) {
+        throw ::cereal::Exception{
+            fmt::format("Failed to load a container ID {} from the archive: {}",
+                        id,
+                        ex.what())};
+    }
+}
+
+} // namespace detail
+
+// This function must exist because cereal does some checks and it's not
+// possible to have only load_minimal for a type without having save_minimal.
+template <class Archive, class Container>
+auto save_minimal(const Archive& ar, const archivable<Container>& value) ->
+    typename container_traits<Container>::container_id::rep_t
+{
+    throw std::logic_error{"Should never be called"};
+}
+
+template <class Archive, class Container>
+void load_minimal(
+    const Archive& ar,
+    archivable<Container>& value,
+    const typename container_traits<Container>::container_id::rep_t& id)
+{
+    // This one is actually called while loading with not-yet-fully-loaded
+    // archive.
+}
+
+} // namespace immer_archive
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <immer-archive/common/parallel.hpp>
+#include <immer-archive/common/verify_policy.hpp>
+#include <immer-archive/node_pools.hpp>
+#include <immer-archive/traits.hpp>
+
+#include <boost/hana.hpp>
+#include <cereal/cereal.hpp>
+
+#include <memory>
+#include <optional>
+
+/**
+ * Storage for the archives of all the immer containers serialized with a value,
+ * independent of the serialization format.
+ */
+
+namespace immer_archive {
+
+namespace detail {
+
+namespace hana = boost::hana;
+
+/**
+ * Unimplemented class to generate a compile-time error and show what the type T
+ * is.
+ */
+template <class T>
+class error_no_archive_for_the_given_type_check_get_archives_types_function;
+
+/**
+ * Archives and functions to serialize types that contain immer-archivable data
+ * structures.
+ */
+template <class Storage, class Names>
+struct archives_save
+{
+    using names_t = Names;
+
+    Storage storage;
+
+    template <class Archive>
+    void save(Archive& ar) const
+    {
+        constexpr auto keys = hana::keys(names_t{});
+        hana::for_each(keys, [&](auto key) {
+            constexpr auto name = names_t{}[key];
+            ar(cereal::make_nvp(name.c_str(), storage[key]));
+        });
+    }
+
+    template <class T>
+    auto& get_save_archive()
+    {
+        using Contains = decltype(hana::contains(storage, hana::type_c<T>));
+        constexpr bool contains = hana::value<Contains>();
+        if constexpr (!contains) {
+            auto err =
+                error_no_archive_for_the_given_type_check_get_archives_types_function<
+                    T>{};
+        }
+        return storage[hana::type_c<T>];
+    }
+};
+
+template <class Container>
+struct archive_type_load
+{
+    typename container_traits<Container>::load_archive_t archive = {};
+    std::optional<typename container_traits<Container>::loader_t> loader;
+
+    archive_type_load() = default;
+
+    archive_type_load(const archive_type_load& other)
+        : archive{other.archive}
+    {
+    }
+
+    archive_type_load& operator=(const archive_type_load& other)
+    {
+        archive = other.archive;
+        return *this;
+    }
+
+    friend bool operator==(const archive_type_load& left,
+                           const archive_type_load& right)
+    {
+        return left.archive == right.archive;
+    }
+};
+
+template <class Storage, class Names>
+struct archives_load
+{
+    using names_t = Names;
+
+    Storage storage;
+    // Given to the loaders when they are created.
+    verify_policy verify = {};
+    std::shared_ptr<node_pools> pools;
+
+    template <class Container>
+    static const char* get_name()
+    {
+        return names_t{}[hana::type_c<Container>].c_str();
+    }
+
+    template <class Container>
+    auto& get_load_archive()
+    {
+        return storage[hana::type_c<Container>].archive;
+    }
+
+    template <class Container>
+    auto& get_loader()
+    {
+        auto& load = storage[hana::type_c<Container>];
+        if (!load.loader) {
+            if constexpr (has_node_pool<Container>) {
+                load.loader.emplace(
+                    load.archive,
+                    verify,
+                    pools ? pools->template find<Container>() : nullptr);
+            } else {
+                load.loader.emplace(load.archive, verify);
+            }
+        }
+        return *load.loader;
+    }
+
+    /**
+     * Load all the containers of all the archives, see preload() of the
+     * loaders.
+     */
+    void preload(std::size_t threads = default_thread_count())
+    {
+        hana::for_each(hana::keys(names_t{}), [&](auto key) {
+            using Container = typename decltype(key)::type;
+            get_loader<Container>().preload(threads);
+        });
+    }
+
+    template <class Archive>
+    void load(Archive& ar)
+    {
+        constexpr auto keys = hana::keys(names_t{});
+        hana::for_each(keys, [&](auto key) {
+            constexpr auto name = names_t{}[key];
+            ar(cereal::make_nvp(name.c_str(), storage[key].archive));
+        });
+    }
+
+    friend bool operator==(const archives_load& left,
+                           const archives_load& right)
+    {
+        return left.storage == right.storage;
+    }
+};
+
+inline auto generate_archives_save(auto type_names)
+{
+    auto storage =
+        hana::fold_left(type_names, hana::make_map(), [](auto map, auto pair) {
+            using Type = typename decltype(+hana::first(pair))::type;
+            return hana::insert(
+                map,
+                hana::make_pair(
+                    hana::first(pair),
+                    typename container_traits<Type>::save_archive_t{}));
+        });
+
+    using Storage = decltype(storage);
+    using Names   = decltype(type_names);
+    return archives_save<Storage, Names>{storage};
+}
+
+inline auto generate_archives_load(auto type_names)
+{
+    auto storage =
+        hana::fold_left(type_names, hana::make_map(), [](auto map, auto pair) {
+            using Type = typename decltype(+hana::first(pair))::type;
+            return hana::insert(
+                map,
+                hana::make_pair(hana::first(pair), archive_type_load<Type>{}));
+        });
+
+    using Storage = decltype(storage);
+    using Names   = decltype(type_names);
+    return archives_load<Storage, Names>{storage};
+}
+
+} // namespace detail
+
+template <class T>
+auto get_archives_types(const T&)
+{
+    return boost::hana::make_map();
+}
+
+template <class Archives>
+constexpr bool is_archive_empty(const Archives& archives)
+{
+    using Result =
+        decltype(boost::hana::is_empty(boost::hana::keys(archives.storage)));
+    return boost::hana::value<Result>();
+}
+
+} // namespace immer_archive
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <immer-archive/cereal/immer_vector.hpp>
+#include <immer-archive/common/archive.hpp>
+#include <immer-archive/common/parallel.hpp>
+#include <immer-archive/common/verify_policy.hpp>
+#include <immer-archive/errors.hpp>
+
+#include <immer/array.hpp>
+#include <immer/map.hpp>
+#include <immer/vector.hpp>
+
+#include <cereal/cereal.hpp>
+
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Arrays are archived by identity: the values of an array are saved once
+ * however many times it is referenced, and all the copies of an array get the
+ * same ID.
+ */
+
+namespace immer_archive::array {
+
+template <typename T, typename MemoryPolicy>
+struct archive_save
+{
+    // Indexed by ID. Keeping the arrays alive makes sure that their buffers are
+    // not reused by other arrays while the archive exists.
+    immer::vector<immer::array<T, MemoryPolicy>> arrays;
+
+    immer::map<const T*, container_id> data_ptr_to_id;
+
+    template <class Archive>
+    void save(Archive& ar) const
+    {
+        ar(cereal::make_size_tag(
+            static_cast<cereal::size_type>(arrays.size())));
+        for (const auto& array : arrays) {
+            ar(values_save<T>{
+                .begin = array.data(),
+                .end   = array.data() + array.size(),
+            });
+        }
+    }
+};
+
+template <typename T>
+struct archive_load
+{
+    immer::vector<values_load<T>> arrays;
+
+    friend bool operator==(const archive_load& left, const archive_load& right)
+    {
+        return left.arrays == right.arrays;
+    }
+
+    template <class Archive>
+    void load(Archive& ar)
+    {
+        using cereal::load;
+        load(ar, arrays);
+    }
+};
+
+template <typename T, typename MemoryPolicy>
+std::pair<archive_save<T, MemoryPolicy>, container_id>
+save_to_archive(immer::array<T, MemoryPolicy> array,
+                archive_save<T, MemoryPolicy> archive)
+{
+    const auto* ptr = array.data();
+    if (const auto* id = archive.data_ptr_to_id.find(ptr)) {
+        // Already been saved
+        return {std::move(archive), *id};
+    }
+
+    const auto id = container_id{archive.arrays.size()};
+    archive.data_ptr_to_id = std::move(archive.data_ptr_to_id).set(ptr, id);
+
+    archive.arrays = std::move(archive.arrays).push_back(std::move(array));
+    return {std::move(archive), id};
+}
+
+/**
+ * Loading the same ID again gives the same array.
+ */
+template <typename T, typename MemoryPolicy>
+class loader
+{
+public:
+    using array_t = immer::array<T, MemoryPolicy>;
+
+    // There's no structure to verify.
+    explicit loader(archive_load<T> ar, verify_policy = {})
+        : ar_{std::move(ar)}
+        , arrays_(ar_.arrays.size())
+    {
+    }
+
+    array_t load(container_id id)
+    {
+        if (id.value >= ar_.arrays.size()) {
+            throw invalid_container_id{id};
+        }
+
+        auto& array = arrays_[id.value];
+        if (!array) {
+            const auto& data = ar_.arrays[id.value].data;
+            using loaded_t   = std::decay_t<decltype(data)>;
+            if constexpr (std::is_same_v<array_t, loaded_t>) {
+                // The loaded values are already in an array of the right type.
+                array = data;
+            } else {
+                array = array_t(data.begin(), data.end());
+            }
+        }
+        return *array;
+    }
+
+    /**
+     * Each array is a single allocation, they are all created on the calling
+     * thread.
+     */
+    void preload(std::size_t = default_thread_count())
+    {
+        for (auto id = std::size_t{}; id < arrays_.size(); ++id) {
+            load(container_id{id});
+        }
+    }
+
+private:
+    const archive_load<T> ar_;
+    std::vector<std::optional<array_t>> arrays_;
+};
+
+} // namespace immer_archive::array
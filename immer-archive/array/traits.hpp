@@ -0,0 +1,17 @@
+#pragma once
+
+#include <immer-archive/array/archive.hpp>
+#include <immer-archive/traits.hpp>
+
+namespace immer_archive {
+
+template <typename T, typename MemoryPolicy>
+struct container_traits<immer::array<T, MemoryPolicy>>
+{
+    using save_archive_t = array::archive_save<T, MemoryPolicy>;
+    using load_archive_t = array::archive_load<T>;
+    using loader_t       = array::loader<T, MemoryPolicy>;
+    using container_id   = immer_archive::container_id;
+};
+
+} // namespace immer_archive
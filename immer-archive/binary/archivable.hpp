@@ -0,0 +1,45 @@
+#pragma once
+
+#include <immer-archive/archivable.hpp>
+#include <immer-archive/binary/binary_immer.hpp>
+#include <immer-archive/binary/binary_with_archive.hpp>
+
+namespace immer_archive {
+
+template <class Storage, class Names, class Container>
+auto save_minimal(
+    const binary_immer_output_archive<detail::archives_save<Storage, Names>>&
+        ar,
+    const archivable<Container>& value)
+{
+    return detail::save_archivable(
+        const_cast<binary_immer_output_archive<
+            detail::archives_save<Storage, Names>>&>(ar)
+            .get_output_archives(),
+        value);
+}
+
+// This function must exist because cereal does some checks and it's not
+// possible to have only load_minimal for a type without having save_minimal.
+template <class Storage, class Names, class Container>
+auto save_minimal(
+    const binary_immer_output_archive<detail::archives_load<Storage, Names>>&
+        ar,
+    const archivable<Container>& value) ->
+    typename container_traits<Container>::container_id::rep_t
+{
+    throw std::logic_error{"Should never be called"};
+}
+
+template <class ImmerArchives, class Container>
+void load_minimal(
+    const binary_immer_input_archive<ImmerArchives>& ar,
+    archivable<Container>& value,
+    const typename container_traits<Container>::container_id::rep_t& id)
+{
+    auto& loader = const_cast<binary_immer_input_archive<ImmerArchives>&>(ar)
+                       .template get_loader<Container>();
+    detail::load_archivable(loader, value, id);
+}
+
+} // namespace immer_archive
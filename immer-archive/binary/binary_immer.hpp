@@ -0,0 +1,296 @@
+#pragma once
+
+#include <immer-archive/common/lazy_archives.hpp>
+
+#include <cereal/archives/binary.hpp>
+
+#include <fmt/format.h>
+
+#include <map>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <string_view>
+
+/**
+ * Special types of archives, working with cereal's binary format, that support
+ * providing extra context (ImmerArchives) to serialize immer data structures
+ * using immer-archive. Just like cereal::BinaryOutputArchive, the data is
+ * written in the native byte order.
+ */
+
+namespace immer_archive {
+
+namespace detail {
+
+/**
+ * Allows reading an in-memory buffer as a stream without copying it.
+ */
+class memory_streambuf : public std::streambuf
+{
+public:
+    memory_streambuf(const char* data, std::size_t size)
+    {
+        auto* begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+
+    explicit memory_streambuf(std::string_view data)
+        : memory_streambuf{data.data(), data.size()}
+    {
+    }
+
+    /**
+     * Return the next size bytes without copying them and move past them.
+     */
+    std::string_view take(std::size_t size)
+    {
+        if (size > static_cast<std::size_t>(egptr() - gptr())) {
+            throw ::cereal::Exception{
+                fmt::format("Failed to read {} bytes from input stream", size)};
+        }
+        const auto result = std::string_view{gptr(), size};
+        setg(eback(), gptr() + size, egptr());
+        return result;
+    }
+
+    /**
+     * Return the bytes that haven't been read yet.
+     */
+    std::string_view rest() const
+    {
+        return {gptr(), static_cast<std::size_t>(egptr() - gptr())};
+    }
+};
+
+} // namespace detail
+
+template <class ImmerArchives>
+class binary_immer_output_archive
+    : public cereal::OutputArchive<binary_immer_output_archive<ImmerArchives>,
+                                   cereal::AllowEmptyClassElision>
+{
+public:
+    binary_immer_output_archive(std::ostream& stream)
+        : cereal::OutputArchive<binary_immer_output_archive<ImmerArchives>,
+                                cereal::AllowEmptyClassElision>{this}
+        , archive{stream}
+    {
+    }
+
+    binary_immer_output_archive(ImmerArchives archives, std::ostream& stream)
+        : cereal::OutputArchive<binary_immer_output_archive<ImmerArchives>,
+                                cereal::AllowEmptyClassElision>{this}
+        , archive{stream}
+        , archives{std::move(archives)}
+    {
+    }
+
+    void saveBinary(const void* data, std::streamsize size)
+    {
+        archive.saveBinary(data, size);
+    }
+
+    ImmerArchives& get_output_archives() { return archives; }
+
+private:
+    cereal::BinaryOutputArchive archive;
+    ImmerArchives archives;
+};
+
+template <class ImmerArchives>
+class binary_immer_input_archive
+    : public cereal::InputArchive<binary_immer_input_archive<ImmerArchives>,
+                                  cereal::AllowEmptyClassElision>
+{
+public:
+    binary_immer_input_archive(ImmerArchives archives_, std::istream& stream)
+        : cereal::InputArchive<binary_immer_input_archive<ImmerArchives>,
+                               cereal::AllowEmptyClassElision>{this}
+        , archive{stream}
+        , own_archives{std::move(archives_)}
+        , archives{&own_archives}
+    {
+    }
+
+    /**
+     * Read another stream, sharing the immer archives with the parent archive.
+     */
+    binary_immer_input_archive(binary_immer_input_archive& parent,
+                               std::istream& stream)
+        : cereal::InputArchive<binary_immer_input_archive<ImmerArchives>,
+                               cereal::AllowEmptyClassElision>{this}
+        , archive{stream}
+        , archives{parent.archives}
+        , lazy_archives{parent.lazy_archives}
+    {
+    }
+
+    void loadBinary(void* const data, std::streamsize size)
+    {
+        archive.loadBinary(data, size);
+    }
+
+    ImmerArchives& get_input_archives() { return *archives; }
+
+    /**
+     * Load the immer archives from the given serialized blobs, indexed by the
+     * archive name, only when they are needed: an archive is loaded the first
+     * time a loader for its type is requested. The blobs are not copied, they
+     * must stay alive as long as the archive is used.
+     */
+    void load_archives_lazily(std::map<std::string, std::string_view> blobs)
+    {
+        lazy_archives = std::make_shared<lazy_archives_t>(lazy_archives_t{
+            .blobs = std::move(blobs),
+        });
+    }
+
+    template <class Container>
+    auto& get_loader()
+    {
+        if (lazy_archives) {
+            load_archive<Container>();
+        }
+        return archives->template get_loader<Container>();
+    }
+
+private:
+    struct lazy_archives_t
+    {
+        std::map<std::string, std::string_view> blobs;
+        detail::lazy_archives_tracker tracker;
+    };
+
+    template <class Container>
+    void load_archive()
+    {
+        const auto name =
+            std::string{ImmerArchives::template get_name<Container>()};
+        lazy_archives->tracker.load_once(name, [&] {
+            const auto it = lazy_archives->blobs.find(name);
+            if (it == lazy_archives->blobs.end()) {
+                throw ::cereal::Exception{
+                    fmt::format("Archive {} is not found", name)};
+            }
+
+            auto& archive_load =
+                archives->template get_load_archive<Container>();
+            try {
+                auto buffer = detail::memory_streambuf{it->second};
+                std::istream stream{&buffer};
+                auto ar = binary_immer_input_archive{*this, stream};
+                ar(archive_load);
+            } catch (...) {
+                archive_load = {};
+                throw;
+            }
+        });
+    }
+
+    cereal::BinaryInputArchive archive;
+    ImmerArchives own_archives;
+    ImmerArchives* archives;
+    std::shared_ptr<lazy_archives_t> lazy_archives;
+};
+
+// ######################################################################
+// Common BinaryArchive serialization functions
+// ######################################################################
+
+//! Saving for POD types to binary
+template <class ImmerArchives,
+          class T,
+          cereal::traits::EnableIf<std::is_arithmetic<T>::value> =
+              cereal::traits::sfinae>
+inline void
+CEREAL_SAVE_FUNCTION_NAME(binary_immer_output_archive<ImmerArchives>& ar,
+                          T const& t)
+{
+    ar.saveBinary(std::addressof(t), sizeof(t));
+}
+
+//! Loading for POD types from binary
+template <class ImmerArchives,
+          class T,
+          cereal::traits::EnableIf<std::is_arithmetic<T>::value> =
+              cereal::traits::sfinae>
+inline void
+CEREAL_LOAD_FUNCTION_NAME(binary_immer_input_archive<ImmerArchives>& ar, T& t)
+{
+    ar.loadBinary(std::addressof(t), sizeof(t));
+}
+
+//! Serializing NVP types to binary
+template <class ImmerArchives, class T>
+inline void
+CEREAL_SAVE_FUNCTION_NAME(binary_immer_output_archive<ImmerArchives>& ar,
+                          cereal::NameValuePair<T> const& t)
+{
+    ar(t.value);
+}
+
+template <class ImmerArchives, class T>
+inline void
+CEREAL_LOAD_FUNCTION_NAME(binary_immer_input_archive<ImmerArchives>& ar,
+                          cereal::NameValuePair<T>& t)
+{
+    ar(t.value);
+}
+
+//! Serializing SizeTags to binary
+template <class ImmerArchives, class T>
+inline void
+CEREAL_SAVE_FUNCTION_NAME(binary_immer_output_archive<ImmerArchives>& ar,
+                          cereal::SizeTag<T> const& t)
+{
+    ar(t.size);
+}
+
+template <class ImmerArchives, class T>
+inline void
+CEREAL_LOAD_FUNCTION_NAME(binary_immer_input_archive<ImmerArchives>& ar,
+                          cereal::SizeTag<T>& t)
+{
+    ar(t.size);
+}
+
+//! Saving binary data
+template <class ImmerArchives, class T>
+inline void
+CEREAL_SAVE_FUNCTION_NAME(binary_immer_output_archive<ImmerArchives>& ar,
+                          cereal::BinaryData<T> const& bd)
+{
+    ar.saveBinary(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+//! Loading binary data
+template <class ImmerArchives, class T>
+inline void
+CEREAL_LOAD_FUNCTION_NAME(binary_immer_input_archive<ImmerArchives>& ar,
+                          cereal::BinaryData<T>& bd)
+{
+    ar.loadBinary(bd.data, static_cast<std::streamsize>(bd.size));
+}
+
+} // namespace immer_archive
+
+// tie input and output archives together
+namespace cereal {
+namespace traits {
+namespace detail {
+template <class ImmerArchives>
+struct get_output_from_input<
+    immer_archive::binary_immer_input_archive<ImmerArchives>>
+{
+    using type = immer_archive::binary_immer_output_archive<ImmerArchives>;
+};
+template <class ImmerArchives>
+struct get_input_from_output<
+    immer_archive::binary_immer_output_archive<ImmerArchives>>
+{
+    using type = immer_archive::binary_immer_input_archive<ImmerArchives>;
+};
+} // namespace detail
+} // namespace traits
+} // namespace cereal
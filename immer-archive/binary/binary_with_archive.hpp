@@ -0,0 +1,150 @@
+#pragma once
+
+#include <immer-archive/archives.hpp>
+#include <immer-archive/binary/binary_immer.hpp>
+#include <immer-archive/common/counting_streambuf.hpp>
+
+#include <cereal/types/string.hpp>
+
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+/**
+ * to_binary_with_archive
+ *
+ * The output starts with the archives, each one serialized separately together
+ * with its name, followed by the value itself. This way, archives can be loaded
+ * on demand while loading the value.
+ */
+
+namespace immer_archive {
+
+/**
+ * Type T must provide a callable free function get_archives_types(const T&).
+ *
+ * Everything is written straight into the stream, the output is never kept in
+ * memory. The archives come first in the output, so the value is serialized
+ * once to collect them and once more to be written, and each archive is
+ * measured before being written after its size. Return the archives.
+ */
+template <typename T>
+auto to_binary_with_archive(std::ostream& os, const T& serializable)
+{
+    namespace hana = boost::hana;
+
+    auto archives =
+        detail::generate_archives_save(get_archives_types(serializable));
+    using Archives = decltype(archives);
+
+    auto discard = detail::counting_streambuf{};
+    {
+        auto value_os = std::ostream{&discard};
+        auto ar       = binary_immer_output_archive<Archives>{value_os};
+        ar(serializable);
+        archives = ar.get_output_archives();
+    }
+
+    {
+        // Saving the archives may add more nodes into other archives (when
+        // archived containers contain other archivable containers), make sure
+        // all of them are collected before writing.
+        auto os2 = std::ostream{&discard};
+        auto ar2 = binary_immer_output_archive<Archives>{archives, os2};
+        ar2(archives);
+        archives = ar2.get_output_archives();
+    }
+
+    {
+        auto ar = cereal::BinaryOutputArchive{os};
+        constexpr auto keys = hana::keys(typename Archives::names_t{});
+        ar(cereal::make_size_tag(
+            static_cast<cereal::size_type>(hana::length(keys))));
+        hana::for_each(keys, [&](auto key) {
+            constexpr auto name = typename Archives::names_t{}[key];
+            const auto write    = [&](std::ostream& archive_os) {
+                auto archive_ar =
+                    binary_immer_output_archive<Archives>{archives, archive_os};
+                archive_ar(archives.storage[key]);
+            };
+
+            // Same layout as saving the archive as a std::string.
+            auto counter = detail::counting_streambuf{};
+            {
+                auto counter_os = std::ostream{&counter};
+                write(counter_os);
+            }
+            ar(std::string{name.c_str()},
+               cereal::make_size_tag(
+                   static_cast<cereal::size_type>(counter.count())));
+            write(os);
+        });
+    }
+
+    {
+        // All the containers are in the archives already, they get the same
+        // IDs as in the first pass.
+        auto ar = binary_immer_output_archive<Archives>{archives, os};
+        ar(serializable);
+    }
+
+    return archives;
+}
+
+/**
+ * Type T must provide a callable free function get_archives_types(const T&).
+ */
+template <typename T>
+auto to_binary_with_archive(const T& serializable)
+{
+    auto os       = std::ostringstream{};
+    auto archives = to_binary_with_archive(os, serializable);
+    return std::make_pair(os.str(), std::move(archives));
+}
+
+/**
+ * The input is read in place, for example from a mapped_file, without copying
+ * the serialized archives. The verify policy applies to all the containers
+ * loaded from the archives. Containers with a pool in pools share their nodes
+ * with the ones restored with the same pools before, see node_pools.
+ */
+template <typename T>
+T from_binary_with_archive(std::string_view input,
+                           verify_policy verify              = {},
+                           std::shared_ptr<node_pools> pools = {})
+{
+    using Archives = std::decay_t<decltype(detail::generate_archives_load(
+        get_archives_types(std::declval<T>())))>;
+
+    auto buffer = detail::memory_streambuf{input};
+    auto blobs  = std::map<std::string, std::string_view>{};
+    {
+        std::istream is{&buffer};
+        auto ar    = cereal::BinaryInputArchive{is};
+        auto count = cereal::size_type{};
+        ar(cereal::make_size_tag(count));
+        for (auto i = cereal::size_type{}; i < count; ++i) {
+            auto name = std::string{};
+            auto size = cereal::size_type{};
+            ar(name, cereal::make_size_tag(size));
+            blobs[std::move(name)] =
+                buffer.take(static_cast<std::size_t>(size));
+        }
+    }
+
+    auto value_buffer = detail::memory_streambuf{buffer.rest()};
+    std::istream is{&value_buffer};
+    auto archives   = Archives{};
+    archives.verify = verify;
+    archives.pools  = std::move(pools);
+
+    auto ar = binary_immer_input_archive<Archives>{std::move(archives), is};
+    ar.load_archives_lazily(std::move(blobs));
+    auto r = T{};
+    ar(r);
+    return r;
+}
+
+} // namespace immer_archive
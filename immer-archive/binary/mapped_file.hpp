@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace immer_archive {
+
+/**
+ * A read-only file mapped into memory (POSIX only), so that it can be given to
+ * from_binary_with_archive without reading it into a buffer first.
+ */
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string& path)
+    {
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            const auto error = errno;
+            throw_error(error, "Failed to open " + path);
+        }
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            const auto error = errno;
+            ::close(fd);
+            throw_error(error, "Failed to stat " + path);
+        }
+
+        size_ = static_cast<std::size_t>(info.st_size);
+        if (size_) {
+            auto* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                const auto error = errno;
+                ::close(fd);
+                throw_error(error, "Failed to map " + path);
+            }
+            data_ = static_cast<const char*>(data);
+            // The whole file is going to be read once, from start to end.
+            ::madvise(data, size_, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    mapped_file(const mapped_file&)            = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    mapped_file(mapped_file&& other)
+        : data_{std::exchange(other.data_, nullptr)}
+        , size_{std::exchange(other.size_, 0)}
+    {
+    }
+
+    mapped_file& operator=(mapped_file&& other)
+    {
+        auto temp = mapped_file{std::move(other)};
+        std::swap(data_, temp.data_);
+        std::swap(size_, temp.size_);
+        return *this;
+    }
+
+    ~mapped_file()
+    {
+        if (data_) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    std::string_view data() const { return {data_, size_}; }
+
+private:
+    [[noreturn]] static void throw_error(int error, const std::string& what)
+    {
+        throw std::system_error{error, std::generic_category(), what};
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+} // namespace immer_archive
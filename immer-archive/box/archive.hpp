@@ -0,0 +1,123 @@
+#pragma once
+
+#include <immer-archive/cereal/immer_vector.hpp>
+#include <immer-archive/common/archive.hpp>
+#include <immer-archive/common/parallel.hpp>
+#include <immer-archive/common/verify_policy.hpp>
+#include <immer-archive/errors.hpp>
+
+#include <immer/box.hpp>
+#include <immer/map.hpp>
+#include <immer/vector.hpp>
+
+#include <cereal/cereal.hpp>
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+/**
+ * Boxes are archived by identity: a box is saved once however many times it is
+ * referenced, and all the copies of a box get the same ID.
+ */
+
+namespace immer_archive::box {
+
+template <typename T, typename MemoryPolicy>
+struct archive_save
+{
+    // Indexed by ID. Keeping the boxes alive makes sure that the address of a
+    // value is not reused by another box while the archive exists.
+    immer::vector<immer::box<T, MemoryPolicy>> boxes;
+
+    immer::map<const T*, container_id> value_ptr_to_id;
+
+    template <class Archive>
+    void save(Archive& ar) const
+    {
+        ar(cereal::make_size_tag(static_cast<cereal::size_type>(boxes.size())));
+        for (const auto& box : boxes) {
+            ar(box.get());
+        }
+    }
+};
+
+template <typename T>
+struct archive_load
+{
+    immer::vector<T> values;
+
+    friend bool operator==(const archive_load& left, const archive_load& right)
+    {
+        return left.values == right.values;
+    }
+
+    template <class Archive>
+    void load(Archive& ar)
+    {
+        using cereal::load;
+        load(ar, values);
+    }
+};
+
+template <typename T, typename MemoryPolicy>
+std::pair<archive_save<T, MemoryPolicy>, container_id>
+save_to_archive(immer::box<T, MemoryPolicy> box,
+                archive_save<T, MemoryPolicy> archive)
+{
+    const auto* ptr = &box.get();
+    if (const auto* id = archive.value_ptr_to_id.find(ptr)) {
+        // Already been saved
+        return {std::move(archive), *id};
+    }
+
+    const auto id = container_id{archive.boxes.size()};
+    archive.value_ptr_to_id = std::move(archive.value_ptr_to_id).set(ptr, id);
+    archive.boxes           = std::move(archive.boxes).push_back(std::move(box));
+    return {std::move(archive), id};
+}
+
+/**
+ * Loading the same ID again gives the same box.
+ */
+template <typename T, typename MemoryPolicy>
+class loader
+{
+public:
+    // There's no structure to verify.
+    explicit loader(archive_load<T> ar, verify_policy = {})
+        : ar_{std::move(ar)}
+        , boxes_(ar_.values.size())
+    {
+    }
+
+    immer::box<T, MemoryPolicy> load(container_id id)
+    {
+        if (id.value >= ar_.values.size()) {
+            throw invalid_container_id{id};
+        }
+
+        auto& box = boxes_[id.value];
+        if (!box) {
+            box.emplace(ar_.values[id.value]);
+        }
+        return *box;
+    }
+
+    /**
+     * Each box is a single allocation, they are all created on the calling
+     * thread.
+     */
+    void preload(std::size_t = default_thread_count())
+    {
+        for (auto id = std::size_t{}; id < boxes_.size(); ++id) {
+            load(container_id{id});
+        }
+    }
+
+private:
+    const archive_load<T> ar_;
+    std::vector<std::optional<immer::box<T, MemoryPolicy>>> boxes_;
+};
+
+} // namespace immer_archive::box
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <immer-archive/box/archive.hpp>
+#include <immer-archive/traits.hpp>
+
+namespace immer_archive {
+
+template <typename T, typename MemoryPolicy>
+struct container_traits<immer::box<T, MemoryPolicy>>
+{
+    using save_archive_t = box::archive_save<T, MemoryPolicy>;
+    using load_archive_t = box::archive_load<T>;
+    using loader_t       = box::loader<T, MemoryPolicy>;
+    using container_id   = immer_archive::container_id;
+};
+
+} // namespace immer_archive
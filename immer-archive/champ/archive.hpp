@@ -1,6 +1,7 @@
 #pragma once
 
 #include <immer-archive/common/archive.hpp>
+#include <immer-archive/errors.hpp>
 
 #include <immer/map.hpp>
 #include <immer/set.hpp>
@@ -75,55 +76,37 @@ struct inner_node_load
 template <class T, immer::detail::hamts::bits_t B>
 struct nodes_save
 {
-    // Saving is simpler with a map
-    immer::map<node_id, inner_node_save<T, B>> inners;
+    // Indexed by node ID, IDs are given in the order the nodes are found.
+    immer::vector<inner_node_save<T, B>> inners;
 
     immer::map<const void*, node_id> node_ptr_to_id;
 };
 
-template <typename T,
-          typename Hash,
-          typename Equal,
-          typename MemoryPolicy,
-          immer::detail::hamts::bits_t B>
-std::pair<nodes_save<T, B>, node_id> get_node_id(
-    nodes_save<T, B> ar,
-    const immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B>* ptr)
-{
-    auto* ptr_void = static_cast<const void*>(ptr);
-    if (auto* maybe_id = ar.node_ptr_to_id.find(ptr_void)) {
-        auto id = *maybe_id;
-        return {std::move(ar), id};
-    }
-
-    const auto id     = node_id{ar.node_ptr_to_id.size()};
-    ar.node_ptr_to_id = std::move(ar.node_ptr_to_id).set(ptr_void, id);
-    return {std::move(ar), id};
-}
-
 template <class T, immer::detail::hamts::bits_t B>
 using nodes_load = immer::vector<inner_node_load<T, B>>;
 
+/**
+ * Copy the saved nodes with IDs from first on into nodes of another type.
+ */
 template <template <class, immer::detail::hamts::bits_t> class InnerNodeType,
           class T,
           immer::detail::hamts::bits_t B>
 immer::vector<InnerNodeType<T, B>>
-linearize_map(const immer::map<node_id, inner_node_save<T, B>>& inners)
+convert_nodes(const immer::vector<inner_node_save<T, B>>& inners,
+              std::size_t first = 0)
 {
-    auto result = immer::vector<InnerNodeType<T, B>>{};
-    for (auto index = std::size_t{}; index < inners.size(); ++index) {
-        auto* p = inners.find(node_id{index});
-        assert(p);
-        const auto& inner = *p;
-        result            = std::move(result).push_back(InnerNodeType<T, B>{
-                       .values     = inner.values,
-                       .children   = inner.children,
-                       .nodemap    = inner.nodemap,
-                       .datamap    = inner.datamap,
-                       .collisions = inner.collisions,
+    auto result = immer::vector<InnerNodeType<T, B>>{}.transient();
+    for (auto it = inners.begin() + first; it < inners.end(); ++it) {
+        const auto& inner = *it;
+        result.push_back(InnerNodeType<T, B>{
+            .values     = inner.values,
+            .children   = inner.children,
+            .nodemap    = inner.nodemap,
+            .datamap    = inner.datamap,
+            .collisions = inner.collisions,
         });
     }
-    return result;
+    return std::move(result).persistent();
 }
 
 /**
@@ -145,9 +128,8 @@ struct container_archive_save
     void save(Archive& ar) const
     {
         // To serialize, just save the list of nodes
-        auto inners = linearize_map<inner_node_save>(nodes.inners);
         using cereal::save;
-        save(ar, inners);
+        save(ar, nodes.inners);
     }
 };
 
@@ -178,7 +160,82 @@ container_archive_load<Container>
 to_load_archive(const container_archive_save<Container>& archive)
 {
     return {
-        .nodes = linearize_map<inner_node_load>(archive.nodes.inners),
+        .nodes = convert_nodes<inner_node_load>(archive.nodes.inners),
+    };
+}
+
+/**
+ * The nodes that were added on top of a base archive. Saving more containers
+ * into a copy of a previous container_archive_save keeps the IDs of the nodes
+ * it already knows and numbers the new nodes after them, so only the nodes
+ * with the newer IDs need to be written.
+ */
+template <class Container>
+struct container_archive_delta_save
+{
+    container_archive_save<Container> archive;
+    std::size_t base_nodes = 0;
+
+    template <class Archive>
+    void save(Archive& ar) const
+    {
+        auto nodes =
+            convert_nodes<inner_node_save>(archive.nodes.inners, base_nodes);
+        ar(CEREAL_NVP(base_nodes), CEREAL_NVP(nodes));
+    }
+};
+
+/**
+ * Describe what was added to the archive since base was saved. The archive must
+ * have been obtained by saving more containers into base.
+ */
+template <class Container>
+container_archive_delta_save<Container>
+make_delta(const container_archive_save<Container>& base,
+           container_archive_save<Container> archive)
+{
+    assert(base.nodes.inners.size() <= archive.nodes.inners.size());
+    return {
+        .archive    = std::move(archive),
+        .base_nodes = base.nodes.inners.size(),
+    };
+}
+
+template <class Container>
+struct container_archive_delta_load
+{
+    using champ_t = std::decay_t<decltype(std::declval<Container>().impl())>;
+    using T       = typename champ_t::node_t::value_t;
+
+    std::size_t base_nodes = 0;
+    nodes_load<T, champ_t::bits> nodes;
+
+    template <class Archive>
+    void load(Archive& ar)
+    {
+        ar(CEREAL_NVP(base_nodes), CEREAL_NVP(nodes));
+    }
+};
+
+/**
+ * Append the nodes of the delta to the base archive. A chain of deltas is
+ * applied one by one, in the order they were saved.
+ */
+template <class Container>
+container_archive_load<Container>
+apply_delta(container_archive_load<Container> base,
+            const container_archive_delta_load<Container>& delta)
+{
+    if (base.nodes.size() != delta.base_nodes) {
+        throw invalid_delta_archive{"the number of nodes doesn't match"};
+    }
+
+    auto nodes = std::move(base.nodes).transient();
+    for (const auto& node : delta.nodes) {
+        nodes.push_back(node);
+    }
+    return {
+        .nodes = std::move(nodes).persistent(),
     };
 }
 
@@ -4,7 +4,11 @@
 #include "load.hpp"
 #include "save.hpp"
 
+#include <immer-archive/common/parallel.hpp>
+#include <immer-archive/common/verify_policy.hpp>
+
 #include <optional>
+#include <vector>
 
 namespace immer_archive {
 namespace champ {
@@ -34,16 +38,6 @@ struct node_traits
     static constexpr auto bits = impl<Node>::bits;
 };
 
-class hash_validation_failed_exception : public archive_exception
-{
-public:
-    hash_validation_failed_exception()
-        : archive_exception{"Hash validation failed, likely different hash "
-                            "algos are used for saving and loading"}
-    {
-    }
-};
-
 template <class Container>
 class container_loader
 {
@@ -52,18 +46,16 @@ class container_loader
     using value_t = typename node_t::value_t;
     using traits  = node_traits<node_t>;
 
-    struct project_value_ptr
-    {
-        const value_t* operator()(const value_t& v) const noexcept
-        {
-            return &v;
-        }
-    };
-
 public:
-    explicit container_loader(container_archive_load<Container> archive)
+    /**
+     * The hashes of the values are validated while loading unless the verify
+     * policy is none. A champ has no other structure to check apart from what
+     * loading already does.
+     */
+    explicit container_loader(container_archive_load<Container> archive,
+                              verify_policy verify = {})
         : archive_{std::move(archive)}
-        , nodes_{archive_.nodes}
+        , nodes_{archive_.nodes, verify.mode != verify_policy::none}
     {
     }
 
@@ -73,36 +65,44 @@ public:
             throw invalid_node_id{root_id};
         }
 
-        auto [root, values]    = nodes_.load_inner(root_id);
-        const auto items_count = [&values = values] {
-            auto count = std::size_t{};
-            for (const auto& items : values) {
-                count += items.size();
-            }
-            return count;
-        }();
-
-        auto impl = champ_t{std::move(root).release(), items_count};
-
-        // Validate the loaded champ by ensuring that all elements can be
-        // found. This verifies the hash function is the same as used while
-        // saving it.
-        for (const auto& items : values) {
-            for (const auto& item : items) {
-                const auto* p = impl.template get<
-                    project_value_ptr,
-                    immer::detail::constantly<const value_t*, nullptr>>(item);
-                if (!p) {
-                    throw hash_validation_failed_exception{};
+        auto [root, items_count] = nodes_.load_inner(root_id, 0);
+
+        // The loader keeps its own reference to the root.
+        root->inc();
+        auto impl = champ_t{root, items_count};
+
+        // XXX This ctor is not public in immer.
+        return impl;
+    }
+
+    /**
+     * Load all the containers of the archive, creating their nodes on the
+     * given number of threads. The archive doesn't list the containers, their
+     * roots are the nodes that are not referenced by any other node. Nodes are
+     * shared between the containers as usual, and later calls to load() reuse
+     * them. Containers that fail to load are skipped, loading them with load()
+     * reports why.
+     */
+    void preload(std::size_t threads = default_thread_count())
+    {
+        nodes_.preload_nodes(threads);
+
+        auto referenced = std::vector<bool>(archive_.nodes.size());
+        for (const auto& node : archive_.nodes) {
+            for (const auto& child : node.children) {
+                if (child.value < referenced.size()) {
+                    referenced[child.value] = true;
                 }
-                if (!(*p == item)) {
-                    throw hash_validation_failed_exception{};
+            }
+        }
+        for (auto index = std::size_t{}; index < referenced.size(); ++index) {
+            if (!referenced[index] && !archive_.nodes[index].collisions) {
+                try {
+                    load(node_id{index});
+                } catch (const archive_exception&) {
                 }
             }
         }
-
-        // XXX This ctor is not public in immer.
-        return impl;
     }
 
 private:
@@ -119,18 +119,19 @@ template <class Container>
 std::pair<container_archive_save<Container>, node_id>
 save_to_archive(Container container, container_archive_save<Container> archive)
 {
-    const auto& impl = container.impl();
-    auto root_id     = node_id{};
-    std::tie(archive.nodes, root_id) =
-        get_node_id(std::move(archive.nodes), impl.root);
+    using champ_t = std::decay_t<decltype(container.impl())>;
+    using node_t  = typename champ_t::node_t;
 
-    if (archive.nodes.inners.count(root_id)) {
+    const auto& impl = container.impl();
+    if (const auto* root_id = archive.nodes.node_ptr_to_id.find(impl.root)) {
         // Already been saved
-        return {std::move(archive), root_id};
+        return {std::move(archive), *root_id};
     }
 
-    archive.nodes = save_nodes(impl, std::move(archive.nodes));
-    assert(archive.nodes.inners.count(root_id));
+    auto save = nodes_archive_builder<typename node_t::value_t, champ_t::bits>{
+        std::move(archive.nodes)};
+    const auto root_id = save.visit(impl.root, 0);
+    archive.nodes      = std::move(save).finish();
 
     archive.containers =
         std::move(archive.containers).push_back(std::move(container));
@@ -138,5 +139,84 @@ save_to_archive(Container container, container_archive_save<Container> archive)
     return {std::move(archive), root_id};
 }
 
+/**
+ * Save several containers into the archive, traversing them on the given
+ * number of threads. Nodes shared between the containers are still saved
+ * once, and the result is the same as saving the containers one by one with
+ * save_to_archive, in order.
+ */
+template <class Container>
+std::pair<container_archive_save<Container>, std::vector<node_id>>
+save_to_archive_parallel(const std::vector<Container>& containers,
+                         container_archive_save<Container> archive,
+                         std::size_t threads = default_thread_count())
+{
+    using champ_t = std::decay_t<decltype(std::declval<Container>().impl())>;
+    using node_t  = typename champ_t::node_t;
+    using collector_t =
+        nodes_collector<typename node_t::value_t, champ_t::bits, node_t>;
+
+    // Traversing the containers is done in parallel, but IDs have to be
+    // assigned sequentially for the archive to be deterministic.
+    auto records =
+        detail::concurrent_node_table<typename collector_t::record_t>{};
+    detail::parallel_for(containers.size(), threads, [&](std::size_t index) {
+        auto collect = collector_t{
+            .ar      = archive.nodes,
+            .records = records,
+            .owner   = index,
+        };
+        collect.visit(containers[index].impl().root, 0);
+    });
+
+    auto save = nodes_archive_builder<typename node_t::value_t, champ_t::bits>{
+        std::move(archive.nodes)};
+    auto ids = std::vector<node_id>{};
+    ids.reserve(containers.size());
+    for (const auto& container : containers) {
+        const auto* root = container.impl().root;
+        if (const auto* root_id = save.find_node_id(root)) {
+            // Already been saved
+            ids.push_back(*root_id);
+            continue;
+        }
+
+        ids.push_back(save_recorded_node(save, records, root));
+        archive.containers =
+            std::move(archive.containers).push_back(container);
+    }
+    archive.nodes = std::move(save).finish();
+
+    return {std::move(archive), std::move(ids)};
+}
+
+/**
+ * Rebuild the containers saved in an in-memory archive on new nodes, without
+ * serializing it. Container is the type of the new containers and may use
+ * another memory policy than the saved ones. Nodes shared in the archive stay
+ * shared between the new containers. The result is indexed by the root node
+ * ID that save_to_archive returned for each container.
+ */
+template <class Container, class SourceContainer>
+immer::map<node_id, Container>
+rebuild_containers(const container_archive_save<SourceContainer>& archive,
+                   verify_policy verify = {})
+{
+    auto loader = container_loader<Container>{
+        container_archive_load<Container>{
+            .nodes = convert_nodes<inner_node_load>(archive.nodes.inners),
+        },
+        verify,
+    };
+    auto result = immer::map<node_id, Container>{}.transient();
+    for (const auto& container : archive.containers) {
+        const auto* root_id =
+            archive.nodes.node_ptr_to_id.find(container.impl().root);
+        assert(root_id);
+        result.set(*root_id, loader.load(*root_id));
+    }
+    return std::move(result).persistent();
+}
+
 } // namespace champ
 } // namespace immer_archive
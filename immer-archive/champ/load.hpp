@@ -1,14 +1,18 @@
 #pragma once
 
 #include <immer-archive/champ/archive.hpp>
+#include <immer-archive/common/parallel.hpp>
 #include <immer-archive/errors.hpp>
-#include <immer-archive/node_ptr.hpp>
-
-#include <immer/flex_vector.hpp>
+#include <immer-archive/xxhash/xxhash.hpp>
 
 #include <boost/range/adaptor/indexed.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <utility>
+
 namespace immer_archive {
 namespace champ {
 
@@ -50,6 +54,47 @@ public:
     }
 };
 
+class invalid_node_depth_exception : public archive_exception
+{
+public:
+    invalid_node_depth_exception(node_id id,
+                                 immer::detail::hamts::count_t expected_depth,
+                                 immer::detail::hamts::count_t real_depth)
+        : archive_exception{
+              fmt::format("Node ID {} is expected to be at depth {} but it is "
+                          "referenced at depth {}",
+                          id,
+                          expected_depth,
+                          real_depth)}
+    {
+    }
+};
+
+class invalid_collision_depth_exception : public archive_exception
+{
+public:
+    invalid_collision_depth_exception(node_id id,
+                                      immer::detail::hamts::count_t depth,
+                                      bool collisions)
+        : archive_exception{
+              fmt::format("Node ID {} at depth {} {} be a collision node",
+                          id,
+                          depth,
+                          collisions ? "can't" : "must")}
+    {
+    }
+};
+
+class hash_validation_failed_exception : public archive_exception
+{
+public:
+    hash_validation_failed_exception()
+        : archive_exception{"Hash validation failed, likely different hash "
+                            "algos are used for saving and loading"}
+    {
+    }
+};
+
 template <class T,
           typename Hash                  = std::hash<T>,
           typename Equal                 = std::equal_to<T>,
@@ -60,20 +105,91 @@ class nodes_loader
 public:
     using champ_t =
         immer::detail::hamts::champ<T, Hash, Equal, MemoryPolicy, B>;
-    using node_t   = typename champ_t::node_t;
-    using node_ptr = immer_archive::node_ptr<node_t>;
+    using node_t  = typename champ_t::node_t;
+    using count_t = immer::detail::hamts::count_t;
+    using hash_t  = immer::detail::hamts::hash_t;
+
+    /**
+     * When validating hashes, every value is hashed once while its node is
+     * created and must be found at the position where the hash puts it. This
+     * proves that the same hash function is used for saving and loading.
+     */
+    explicit nodes_loader(nodes_load<T, B> archive, bool validate_hashes = true)
+        : archive_{std::move(archive)}
+        , validate_hashes_{validate_hashes}
+    {
+    }
 
-    using values_t = immer::flex_vector<immer::array<T>>;
+    nodes_loader(const nodes_loader&)            = delete;
+    nodes_loader& operator=(const nodes_loader&) = delete;
 
-    explicit nodes_loader(nodes_load<T, B> archive)
-        : archive_{std::move(archive)}
+    nodes_loader(nodes_loader&& other)
+        : archive_{other.archive_}
+        , validate_hashes_{other.validate_hashes_}
+        , loaded_{std::exchange(other.loaded_, {})}
+        , preloaded_{std::exchange(other.preloaded_, {})}
+    {
+    }
+
+    /**
+     * The loader keeps one reference to every node it has loaded, so that
+     * loading the same node ID again gives the same node. Nodes are regular
+     * immer nodes: children are referenced by their parents, and the
+     * containers built from them free them the normal way.
+     */
+    ~nodes_loader()
+    {
+        for (const auto& [id, node] : loaded_) {
+            if (node.node->dec()) {
+                node_t::delete_deep(node.node, node.depth * B);
+            }
+        }
+        // Preloaded nodes that were never used have no children linked yet.
+        for (const auto& [index, node] : boost::adaptors::index(preloaded_)) {
+            if (node) {
+                if (archive_[index].collisions) {
+                    node_t::delete_collision(node);
+                } else {
+                    node_t::delete_inner(node);
+                }
+            }
+        }
+    }
+
+    /**
+     * Create, using the given number of threads, all the nodes of the archive
+     * that have not been loaded yet, except for linking them to their
+     * children. The nodes are created independently of each other, and
+     * loading a container afterwards only has to link them together.
+     *
+     * The heap of MemoryPolicy must support allocating from several threads,
+     * which is the case of immer's default heap. Invalid nodes are skipped
+     * here and reported when a container that uses them is loaded.
+     */
+    void preload_nodes(std::size_t threads)
     {
+        preloaded_.resize(archive_.size());
+        detail::parallel_for(archive_.size(), threads, [&](std::size_t index) {
+            const auto& node_info = archive_[index];
+            if (preloaded_[index] || loaded_.count(node_id{index}) ||
+                !is_valid_inner(node_info)) {
+                return;
+            }
+            preloaded_[index] = node_info.collisions
+                                    ? make_collision(node_info)
+                                    : make_inner(node_info);
+        });
     }
 
-    std::pair<node_ptr, values_t> load_collision(node_id id)
+    /**
+     * Return the node with the given ID, which is borrowed from the loader, and
+     * the number of values that the node contains, including its children.
+     */
+    std::pair<node_t*, std::size_t>
+    load_collision(node_id id, count_t depth, hash_t prefix)
     {
-        if (auto* p = collisions_.find(id)) {
-            return *p;
+        if (auto* p = find_loaded(id, depth, prefix)) {
+            return {p->node, p->size};
         }
 
         if (id.value >= archive_.size()) {
@@ -81,23 +197,38 @@ public:
         }
 
         const auto& node_info = archive_[id.value];
+        if (validate_hashes_) {
+            // All the bits of the hash are used at this depth, the values
+            // must have exactly the same hash.
+            for_each_hash(node_info.values, [&](hash_t hash) {
+                validate_prefix(hash, depth, prefix);
+            });
+        }
 
-        const auto n = node_info.values.data.size();
-        auto node    = node_ptr{node_t::make_collision_n(n),
-                             [](auto* ptr) { node_t::delete_collision(ptr); }};
-        immer::detail::uninitialized_copy(node_info.values.data.begin(),
-                                          node_info.values.data.end(),
-                                          node.get()->collisions());
-        auto result =
-            std::make_pair(std::move(node), values_t{node_info.values.data});
-        collisions_ = std::move(collisions_).set(id, result);
-        return result;
+        auto* node = take_preloaded(id);
+        node       = node ? node : make_collision(node_info);
+
+        const auto size = node_info.values.data.size();
+
+        loaded_ = std::move(loaded_).set(id,
+                                         loaded_node{
+                                             .node   = node,
+                                             .size   = size,
+                                             .depth  = depth,
+                                             .prefix = prefix,
+                                         });
+        return {node, size};
     }
 
-    std::pair<node_ptr, values_t> load_inner(node_id id)
+    /**
+     * The prefix holds the bits of the hash that lead from the root to the
+     * node, all the values under the node share them.
+     */
+    std::pair<node_t*, std::size_t>
+    load_inner(node_id id, count_t depth, hash_t prefix = 0)
     {
-        if (auto* p = inners_.find(id)) {
-            return *p;
+        if (auto* p = find_loaded(id, depth, prefix)) {
+            return {p->node, p->size};
         }
 
         if (id.value >= archive_.size()) {
@@ -128,99 +259,225 @@ public:
             }
         }
 
-        auto values = values_t{};
+        if (validate_hashes_) {
+            validate_inner_values(node_info, depth, prefix);
+        }
 
-        // Load children
-        const auto children = [&values, &node_info, this] {
-            auto [children_ptrs, children_values] =
-                load_children(node_info.children);
+        // Load children. They stay owned by the loader until they are linked
+        // into the new node below, so nothing leaks if loading throws.
+        const auto [children, children_size] =
+            load_children(node_info, depth, prefix);
 
-            if (!children_values.empty()) {
-                values = std::move(values) + children_values;
-            }
+        auto* inner = node_info.collisions ? nullptr : take_preloaded(id);
+        inner       = inner ? inner : make_inner(node_info);
 
-            /**
-             * NOTE: Be careful with release_full and exceptions, nodes will not
-             * be freed automatically.
-             */
-            auto result = immer::vector<ptr_with_deleter<node_t>>{};
-            for (auto& child : children_ptrs) {
-                result = std::move(result).push_back(
-                    std::move(child).release_full());
-            }
-            return result;
-        }();
-        const auto delete_children = [children]() {
-            for (const auto& ptr : children) {
-                ptr.dec();
-            }
-        };
-
-        auto inner =
-            node_ptr{node_t::make_inner_n(children_count, values_count),
-                     [delete_children](auto* ptr) {
-                         node_t::delete_inner(ptr);
-                         delete_children();
-                     }};
-        inner.get()->impl.d.data.inner.nodemap = node_info.nodemap;
-        inner.get()->impl.d.data.inner.datamap = node_info.datamap;
-
-        // Values
-        if (values_count) {
-            immer::detail::uninitialized_copy(node_info.values.data.begin(),
-                                              node_info.values.data.end(),
-                                              inner.get()->values());
-            values = std::move(values).push_back(node_info.values.data);
+        // Set children, each one is referenced by the new node.
+        for (const auto& [index, child] : boost::adaptors::index(children)) {
+            child->inc();
+            inner->children()[index] = child;
         }
 
-        // Set children
-        for (const auto& [index, child_ptr] :
-             boost::adaptors::index(children)) {
-            inner.get()->children()[index] = child_ptr.ptr;
-        }
+        const auto size = children_size + values_count;
 
-        inners_ = std::move(inners_).set(id, std::make_pair(inner, values));
-        return {std::move(inner), std::move(values)};
+        loaded_ = std::move(loaded_).set(id,
+                                         loaded_node{
+                                             .node   = inner,
+                                             .size   = size,
+                                             .depth  = depth,
+                                             .prefix = prefix,
+                                         });
+        return {inner, size};
     }
 
-    std::pair<node_ptr, values_t> load_some_node(node_id id)
+    std::pair<node_t*, std::size_t>
+    load_some_node(node_id id, count_t depth, hash_t prefix)
     {
+        using immer::detail::hamts::max_depth;
+
         if (id.value >= archive_.size()) {
             throw invalid_node_id{id};
         }
 
-        if (archive_[id.value].collisions) {
-            return load_collision(id);
+        // immer frees the nodes at the maximum depth as collision nodes and
+        // all the other ones as inner nodes.
+        const bool collisions = archive_[id.value].collisions;
+        if (collisions != (depth == max_depth<B>)) {
+            throw invalid_collision_depth_exception{id, depth, collisions};
+        }
+
+        if (collisions) {
+            return load_collision(id, depth, prefix);
         } else {
-            return load_inner(id);
+            return load_inner(id, depth, prefix);
         }
     }
 
-    std::pair<std::vector<node_ptr>, values_t>
-    load_children(const immer::vector<node_id>& children_ids)
+    /**
+     * Load the children of a node at the given depth. Children are ordered by
+     * their bit in the nodemap, which extends the prefix of each one.
+     */
+    std::pair<std::vector<node_t*>, std::size_t>
+    load_children(const inner_node_load<T, B>& node_info,
+                  count_t depth,
+                  hash_t prefix)
     {
-        auto children = std::vector<node_ptr>{};
-        auto values   = values_t{};
-        for (const auto& child_node_id : children_ids) {
-            auto [child, child_values] = load_some_node(child_node_id);
+        auto children = std::vector<node_t*>{};
+        auto size     = std::size_t{};
+        auto nodemap  = node_info.nodemap;
+        for (const auto& child_node_id : node_info.children) {
+            const auto bit = static_cast<hash_t>(std::countr_zero(nodemap));
+            const auto child_prefix = prefix | (bit << (depth * B));
+            nodemap &= nodemap - 1;
+
+            const auto [child, child_size] =
+                load_some_node(child_node_id, depth + 1, child_prefix);
             if (!child) {
                 throw archive_exception{
                     fmt::format("Failed to load node ID {}", child_node_id)};
             }
 
-            if (!child_values.empty()) {
-                values = std::move(values) + child_values;
+            size += child_size;
+            children.push_back(child);
+        }
+        return {std::move(children), size};
+    }
+
+private:
+    struct loaded_node
+    {
+        node_t* node;
+        // The number of values in the node and its children.
+        std::size_t size;
+        count_t depth;
+        hash_t prefix;
+    };
+
+    const loaded_node*
+    find_loaded(node_id id, count_t depth, hash_t prefix) const
+    {
+        auto* p = loaded_.find(id);
+        if (p && p->depth != depth) {
+            // The loader frees a node according to its depth, a node can't be
+            // shared between different depths.
+            throw invalid_node_depth_exception{id, p->depth, depth};
+        }
+        if (p && validate_hashes_ && p->prefix != prefix) {
+            // The values of the node were validated at another position.
+            throw hash_validation_failed_exception{};
+        }
+        return p;
+    }
+
+    static void validate_prefix(hash_t hash, count_t depth, hash_t prefix)
+    {
+        const auto bits = std::size_t{depth} * B;
+        const auto mask = bits >= sizeof(hash_t) * 8
+                              ? ~hash_t{}
+                              : (hash_t{1} << bits) - 1;
+        if ((hash & mask) != prefix) {
+            throw hash_validation_failed_exception{};
+        }
+    }
+
+    /**
+     * The values of an inner node are ordered by their bit in the datamap,
+     * which is given by the bits of their hash at this depth.
+     */
+    static void validate_inner_values(const inner_node_load<T, B>& node_info,
+                                      count_t depth,
+                                      hash_t prefix)
+    {
+        const auto shift = std::size_t{depth} * B;
+        auto datamap     = node_info.datamap;
+        for_each_hash(node_info.values, [&](hash_t hash) {
+            validate_prefix(hash, depth, prefix);
+            const auto index = (hash >> shift) & ((hash_t{1} << B) - 1);
+            if (index != static_cast<hash_t>(std::countr_zero(datamap))) {
+                throw hash_validation_failed_exception{};
             }
+            datamap &= datamap - 1;
+        });
+    }
 
-            children.push_back(std::move(child));
+    /**
+     * Call f with the hash of each value. When Hash is xx_hash of values that
+     * are hashed as their bytes, the values are hashed together, a node's
+     * worth at a time.
+     */
+    template <class F>
+    static void for_each_hash(const values_load<T>& values, F&& f)
+    {
+        const auto* first = values.data.data();
+        const auto* last  = first + values.data.size();
+        if constexpr (immer_archive::detail::is_batch_of_bytes_v<T, Hash>) {
+            constexpr auto chunk =
+                std::size_t{immer::detail::hamts::branches<B>};
+            auto hashes = std::array<std::size_t, chunk>{};
+            for (auto p = first; p != last;) {
+                const auto n =
+                    std::min(static_cast<std::size_t>(last - p), chunk);
+                xx_hash_batch<T, Hash>(p, p + n, hashes.data());
+                for (auto i = std::size_t{}; i < n; ++i) {
+                    f(hashes[i]);
+                }
+                p += n;
+            }
+        } else {
+            for (auto p = first; p != last; ++p) {
+                f(Hash{}(*p));
+            }
         }
-        return {std::move(children), std::move(values)};
     }
 
-private:
+    static bool is_valid_inner(const inner_node_load<T, B>& node_info)
+    {
+        return node_info.collisions ||
+               (immer::detail::hamts::popcount(node_info.nodemap) ==
+                    node_info.children.size() &&
+                immer::detail::hamts::popcount(node_info.datamap) ==
+                    node_info.values.data.size());
+    }
+
+    static node_t* make_collision(const inner_node_load<T, B>& node_info)
+    {
+        const auto n = node_info.values.data.size();
+        auto* node   = node_t::make_collision_n(n);
+        immer::detail::uninitialized_copy(node_info.values.data.begin(),
+                                          node_info.values.data.end(),
+                                          node->collisions());
+        return node;
+    }
+
+    /**
+     * Create an inner node with its values, the children are linked by the
+     * caller.
+     */
+    static node_t* make_inner(const inner_node_load<T, B>& node_info)
+    {
+        auto* inner = node_t::make_inner_n(node_info.children.size(),
+                                           node_info.values.data.size());
+        inner->impl.d.data.inner.nodemap = node_info.nodemap;
+        inner->impl.d.data.inner.datamap = node_info.datamap;
+        if (!node_info.values.data.empty()) {
+            immer::detail::uninitialized_copy(node_info.values.data.begin(),
+                                              node_info.values.data.end(),
+                                              inner->values());
+        }
+        return inner;
+    }
+
+    node_t* take_preloaded(node_id id)
+    {
+        if (id.value < preloaded_.size()) {
+            return std::exchange(preloaded_[id.value], nullptr);
+        }
+        return nullptr;
+    }
+
     const nodes_load<T, B> archive_;
-    immer::map<node_id, std::pair<node_ptr, values_t>> collisions_;
-    immer::map<node_id, std::pair<node_ptr, values_t>> inners_;
+    const bool validate_hashes_;
+    immer::map<node_id, loaded_node> loaded_;
+    std::vector<node_t*> preloaded_;
 };
 
 } // namespace champ
@@ -1,24 +1,87 @@
 #pragma once
 
 #include <immer-archive/champ/archive.hpp>
+#include <immer-archive/common/concurrent_node_table.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <vector>
+
 namespace immer_archive {
 namespace champ {
 
+/**
+ * Collects the nodes of a champ into the archive. The node list and the map of
+ * the archive are edited through transients while visiting the nodes and
+ * turned back into persistent ones by finish().
+ */
 template <class T, immer::detail::hamts::bits_t B>
 struct nodes_archive_builder
 {
-    nodes_save<T, B> ar;
+    using nodes_t = nodes_save<T, B>;
+
+    typename decltype(nodes_t::inners)::transient_type inners;
+    typename decltype(nodes_t::node_ptr_to_id)::transient_type node_ptr_to_id;
 
-    void visit_inner(const auto* node, auto depth)
+    explicit nodes_archive_builder(nodes_t ar)
+        : inners{std::move(ar.inners).transient()}
+        , node_ptr_to_id{std::move(ar.node_ptr_to_id).transient()}
     {
-        auto id = get_node_id(node);
-        if (ar.inners.count(id)) {
-            return;
+    }
+
+    nodes_t finish() &&
+    {
+        return {
+            .inners         = std::move(inners).persistent(),
+            .node_ptr_to_id = std::move(node_ptr_to_id).persistent(),
+        };
+    }
+
+    /**
+     * Return the ID of a node that is already in the archive.
+     */
+    const node_id* find_node_id(const void* ptr) const
+    {
+        return node_ptr_to_id.find(ptr);
+    }
+
+    /**
+     * Give the next ID to a new node and reserve its place in the node list.
+     * The node is set once its children have their IDs, so that IDs are given
+     * in pre-order.
+     */
+    node_id add_node(const void* ptr)
+    {
+        const auto id = node_id{inners.size()};
+        node_ptr_to_id.set(ptr, id);
+        inners.push_back({});
+        return id;
+    }
+
+    void set_node(node_id id, inner_node_save<T, B> node_info)
+    {
+        inners.set(id.value, std::move(node_info));
+    }
+
+    node_id visit(const auto* node, immer::detail::hamts::count_t depth)
+    {
+        using immer::detail::hamts::max_depth;
+
+        if (const auto* id = find_node_id(node)) {
+            return *id;
         }
 
+        const auto id = add_node(node);
+        set_node(id,
+                 depth < max_depth<B> ? inner_info(node, depth)
+                                      : collision_info(node));
+        return id;
+    }
+
+private:
+    inner_node_save<T, B> inner_info(const auto* node,
+                                     immer::detail::hamts::count_t depth)
+    {
         auto node_info = inner_node_save<T, B>{
             .nodemap = node->nodemap(),
             .datamap = node->datamap(),
@@ -32,69 +95,111 @@ struct nodes_archive_builder
             auto fst = node->children();
             auto lst = fst + node->children_count();
             for (; fst != lst; ++fst) {
-                node_info.children =
-                    std::move(node_info.children).push_back(get_node_id(*fst));
-                visit(*fst, depth + 1);
+                node_info.children = std::move(node_info.children)
+                                         .push_back(visit(*fst, depth + 1));
             }
         }
+        return node_info;
+    }
 
-        ar.inners = std::move(ar.inners).set(id, node_info);
+    static inner_node_save<T, B> collision_info(const auto* node)
+    {
+        return {
+            .values     = {node->collisions(),
+                           node->collisions() + node->collision_count()},
+            .collisions = true,
+        };
     }
+};
 
-    void visit_collision(const auto* node)
+/**
+ * What nodes_archive_builder needs to know about a node, collected while
+ * traversing the containers in parallel.
+ */
+template <class T, immer::detail::hamts::bits_t B, class Node>
+struct node_record
+{
+    // Everything except for the children IDs, which are not known yet.
+    inner_node_save<T, B> node_info;
+    std::vector<const Node*> children;
+};
+
+/**
+ * Records the nodes of a champ that are not in the archive yet, on behalf of
+ * the container with the given index. Nodes already claimed by a container
+ * with a lower index are skipped together with their children.
+ */
+template <class T, immer::detail::hamts::bits_t B, class Node>
+struct nodes_collector
+{
+    using record_t = node_record<T, B, Node>;
+
+    const nodes_save<T, B>& ar;
+    detail::concurrent_node_table<record_t>& records;
+    std::size_t owner;
+
+    void visit(const Node* node, immer::detail::hamts::count_t depth)
     {
-        auto id = get_node_id(node);
-        if (ar.inners.count(id)) {
+        using immer::detail::hamts::max_depth;
+
+        if (ar.node_ptr_to_id.find(node)) {
+            return;
+        }
+        auto* record = records.insert(node, owner);
+        if (!record) {
             return;
         }
 
-        ar.inners = std::move(ar.inners).set(
-            id,
-            inner_node_save<T, B>{
+        if (depth >= max_depth<B>) {
+            record->node_info = {
                 .values     = {node->collisions(),
                                node->collisions() + node->collision_count()},
                 .collisions = true,
-            });
-    }
-
-    void visit(const auto* node, immer::detail::hamts::count_t depth)
-    {
-        using immer::detail::hamts::max_depth;
-
-        if (depth < max_depth<B>) {
-            visit_inner(node, depth);
-        } else {
-            visit_collision(node);
+            };
+            return;
         }
-    }
 
-    node_id get_node_id(auto* ptr)
-    {
-        auto [ar2, id] = immer_archive::champ::get_node_id(std::move(ar), ptr);
-        ar             = std::move(ar2);
-        return id;
+        record->node_info = {
+            .nodemap = node->nodemap(),
+            .datamap = node->datamap(),
+        };
+        if (node->datamap()) {
+            record->node_info.values = {node->values(),
+                                        node->values() + node->data_count()};
+        }
+        if (node->nodemap()) {
+            auto fst = node->children();
+            auto lst = fst + node->children_count();
+            for (; fst != lst; ++fst) {
+                record->children.push_back(*fst);
+                visit(*fst, depth + 1);
+            }
+        }
     }
 };
 
-template <typename T,
-          typename Hash,
-          typename Equal,
-          typename MemoryPolicy,
-          immer::detail::hamts::bits_t B,
-          class Archive>
-auto save_nodes(
-    const immer::detail::hamts::champ<T, Hash, Equal, MemoryPolicy, B>& champ,
-    Archive ar)
+/**
+ * Add a recorded node and its children to the archive, visiting them in the
+ * same order as nodes_archive_builder does, so that they get the same IDs.
+ */
+template <class T, immer::detail::hamts::bits_t B, class Records, class Node>
+node_id save_recorded_node(nodes_archive_builder<T, B>& save,
+                           const Records& records,
+                           const Node* ptr)
 {
-    using champ_t = std::decay_t<decltype(champ)>;
-    using node_t  = typename champ_t::node_t;
-
-    auto save = nodes_archive_builder<typename node_t::value_t, B>{
-        .ar = std::move(ar),
-    };
-    save.visit(champ.root, 0);
+    if (const auto* id = save.find_node_id(ptr)) {
+        return *id;
+    }
 
-    return std::move(save.ar);
+    const auto id      = save.add_node(ptr);
+    const auto& record = records.at(ptr);
+    auto node_info     = record.node_info;
+    for (const auto* child : record.children) {
+        const auto child_id = save_recorded_node(save, records, child);
+        node_info.children  = std::move(node_info.children).push_back(child_id);
+    }
+    save.set_node(id, std::move(node_info));
+    return id;
 }
 
 } // namespace champ
@@ -37,4 +37,13 @@ struct container_traits<immer::table<T, KeyFn, Hash, Equal, MemoryPolicy, B>>
     : champ_traits<immer::table<T, KeyFn, Hash, Equal, MemoryPolicy, B>>
 {};
 
+template <typename T,
+          typename Hash,
+          typename Equal,
+          typename MemoryPolicy,
+          immer::detail::hamts::bits_t B>
+struct container_traits<immer::set<T, Hash, Equal, MemoryPolicy, B>>
+    : champ_traits<immer::set<T, Hash, Equal, MemoryPolicy, B>>
+{};
+
 } // namespace immer_archive
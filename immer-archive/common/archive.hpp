@@ -6,6 +6,9 @@
 
 #include <cereal/types/utility.hpp>
 
+#include <algorithm>
+#include <type_traits>
+
 namespace immer_archive {
 
 struct node_id_tag;
@@ -19,6 +22,8 @@ struct values_save
 {
     const T* begin = nullptr;
     const T* end   = nullptr;
+
+    std::size_t size() const { return end - begin; }
 };
 
 template <class T>
@@ -44,13 +49,37 @@ struct values_load
     }
 };
 
+namespace detail {
+
+/**
+ * Just like cereal does for std::vector, arithmetic values are written as one
+ * contiguous block by the archives that support binary data.
+ */
+template <class T, class Archive>
+constexpr bool is_output_binary_block_v =
+    std::is_arithmetic_v<T> &&
+    cereal::traits::is_output_serializable<cereal::BinaryData<T>,
+                                           Archive>::value;
+
+template <class T, class Archive>
+constexpr bool is_input_binary_block_v =
+    std::is_arithmetic_v<T> &&
+    cereal::traits::is_input_serializable<cereal::BinaryData<T>,
+                                          Archive>::value;
+
+} // namespace detail
+
 template <class Archive, class T>
 void save(Archive& ar, const values_save<T>& value)
 {
-    ar(cereal::make_size_tag(
-        static_cast<cereal::size_type>(value.end - value.begin)));
-    for (auto p = value.begin; p != value.end; ++p) {
-        ar(*p);
+    const auto size = static_cast<cereal::size_type>(value.end - value.begin);
+    ar(cereal::make_size_tag(size));
+    if constexpr (detail::is_output_binary_block_v<T, Archive>) {
+        ar(cereal::binary_data(value.begin, size * sizeof(T)));
+    } else {
+        for (auto p = value.begin; p != value.end; ++p) {
+            ar(*p);
+        }
     }
 }
 
@@ -60,10 +89,38 @@ void load(Archive& ar, values_load<T>& m)
     cereal::size_type size;
     ar(cereal::make_size_tag(size));
 
-    for (auto i = cereal::size_type{}; i < size; ++i) {
-        T x;
-        ar(x);
-        m.data = std::move(m.data).push_back(std::move(x));
+    if constexpr (detail::is_input_binary_block_v<T, Archive>) {
+        // The size is not validated yet, the values are read in bounded chunks
+        // so that a corrupted size fails at the end of the input instead of
+        // allocating it all upfront. They are read straight into the array,
+        // which is allocated exactly for the first chunk and then grows
+        // geometrically like any transient.
+        constexpr auto chunk_size = std::size_t{1} << 16;
+        auto remaining            = static_cast<std::size_t>(size);
+        auto first                = std::size_t{};
+
+        auto data =
+            immer::array<T>(std::min(remaining, chunk_size)).transient();
+        while (remaining) {
+            const auto count = std::min(remaining, chunk_size);
+            while (data.size() < first + count) {
+                data.push_back(T{});
+            }
+            ar(cereal::binary_data(data.data_mut() + first, count * sizeof(T)));
+            first += count;
+            remaining -= count;
+        }
+        m.data = std::move(data).persistent();
+    } else {
+        // Persistent push_back would copy the whole array for every element.
+        // Not reserving the size upfront, it's not validated yet.
+        auto data = std::move(m.data).transient();
+        for (auto i = cereal::size_type{}; i < size; ++i) {
+            T x;
+            ar(x);
+            data.push_back(std::move(x));
+        }
+        m.data = std::move(data).persistent();
     }
 }
 
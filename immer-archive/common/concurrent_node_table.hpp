@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace immer_archive::detail {
+
+/**
+ * A table from node pointers to records that several threads can fill at the
+ * same time while saving containers in parallel. It's split into shards, each
+ * one protected by its own mutex.
+ *
+ * A node may be seen differently by the containers that share it, for example
+ * a leaf used as the tail of a vector and of a shorter one taken from it. Each
+ * container claims nodes with its index, and the record of the container with
+ * the lowest index is kept, like when the containers are saved one by one, in
+ * order. Which thread gets to a node first doesn't matter.
+ */
+template <class Record>
+class concurrent_node_table
+{
+public:
+    /**
+     * Add an empty record for the node on behalf of the given container,
+     * unless the node has already been claimed by that container or by one
+     * with a lower index. Return the new record, which only the calling thread
+     * is allowed to fill, or nullptr.
+     */
+    Record* insert(const void* ptr, std::size_t owner)
+    {
+        auto& shard  = get_shard(ptr);
+        auto lock    = std::lock_guard{shard.mutex};
+        auto& claims = shard.records[ptr];
+        if (!claims.empty() && claims.begin()->first <= owner) {
+            return nullptr;
+        }
+        return &claims[owner];
+    }
+
+    /**
+     * Return the record of the container with the lowest index. Must be
+     * called only once all the insertions are done.
+     */
+    const Record& at(const void* ptr) const
+    {
+        return get_shard(ptr).records.at(ptr).begin()->second;
+    }
+
+private:
+    static constexpr auto shards_bits  = 6;
+    static constexpr auto shards_count = std::size_t{1} << shards_bits;
+
+    struct shard
+    {
+        mutable std::mutex mutex;
+        // Records never move when the maps grow, so they can be filled
+        // without holding the lock.
+        std::unordered_map<const void*, std::map<std::size_t, Record>> records;
+    };
+
+    const shard& get_shard(const void* ptr) const
+    {
+        // Nodes are aligned, spread the pointers with a multiplicative hash.
+        const auto hash =
+            static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(ptr)) *
+            UINT64_C(0x9e3779b97f4a7c15);
+        return shards_[hash >> (64 - shards_bits)];
+    }
+
+    shard& get_shard(const void* ptr)
+    {
+        return const_cast<shard&>(std::as_const(*this).get_shard(ptr));
+    }
+
+    std::array<shard, shards_count> shards_;
+};
+
+} // namespace immer_archive::detail
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <streambuf>
+
+namespace immer_archive {
+namespace detail {
+
+/**
+ * Discards everything written to it, only counting the characters. Lets the
+ * archives be collected, or the size of an output be measured, without keeping
+ * the output in memory.
+ */
+class counting_streambuf : public std::streambuf
+{
+public:
+    std::size_t count() const { return count_; }
+
+protected:
+    std::streamsize xsputn(const char_type*, std::streamsize count) override
+    {
+        count_ += static_cast<std::size_t>(count);
+        return count;
+    }
+
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            ++count_;
+        }
+        return traits_type::not_eof(ch);
+    }
+
+private:
+    std::size_t count_ = 0;
+};
+
+} // namespace detail
+} // namespace immer_archive
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cereal/cereal.hpp>
+
+#include <fmt/format.h>
+
+#include <map>
+#include <string>
+
+namespace immer_archive::detail {
+
+/**
+ * Keeps track of the archives that are loaded on demand, so that each archive
+ * is loaded only once and an archive that requires itself to be loaded is
+ * reported instead of recursing forever.
+ */
+class lazy_archives_tracker
+{
+public:
+    template <class Load>
+    void load_once(const std::string& name, Load&& load)
+    {
+        if (auto it = states.find(name); it != states.end()) {
+            if (it->second == state::loading) {
+                throw ::cereal::Exception{fmt::format(
+                    "Archive {} requires itself to be loaded", name)};
+            }
+            return;
+        }
+
+        states[name] = state::loading;
+        try {
+            load();
+        } catch (...) {
+            states.erase(name);
+            throw;
+        }
+        states[name] = state::loaded;
+    }
+
+private:
+    enum class state
+    {
+        loading,
+        loaded,
+    };
+
+    std::map<std::string, state> states;
+};
+
+} // namespace immer_archive::detail
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace immer_archive {
+
+inline std::size_t default_thread_count()
+{
+    return std::max(std::size_t{1},
+                    std::size_t{std::thread::hardware_concurrency()});
+}
+
+namespace detail {
+
+/**
+ * Call f(index) for every index in [0, count), spreading the calls over up to
+ * the given number of threads, including the calling one. The first exception
+ * thrown by f stops the remaining work and is rethrown once all threads are
+ * done.
+ */
+template <class F>
+void parallel_for(std::size_t count, std::size_t threads, F&& f)
+{
+    threads = std::min(threads, count);
+    if (threads <= 1) {
+        for (auto index = std::size_t{}; index < count; ++index) {
+            f(index);
+        }
+        return;
+    }
+
+    auto next  = std::atomic<std::size_t>{0};
+    auto error = std::exception_ptr{};
+    auto mutex = std::mutex{};
+
+    const auto work = [&] {
+        for (auto index = next++; index < count; index = next++) {
+            try {
+                f(index);
+            } catch (...) {
+                auto lock = std::lock_guard{mutex};
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    {
+        // jthread joins on destruction, also when starting a thread throws.
+        auto pool = std::vector<std::jthread>{};
+        pool.reserve(threads - 1);
+        for (auto i = std::size_t{1}; i < threads; ++i) {
+            pool.emplace_back(work);
+        }
+        work();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace detail
+} // namespace immer_archive
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+namespace immer_archive {
+
+/**
+ * How much of a freshly loaded container is checked against its archive, on
+ * top of the checks that loading does anyway. Those already make sure that
+ * the loaded nodes are safe to use, for example that the leaves and the tail
+ * of a vector have the number of elements its size implies. The extra pass
+ * walks the loaded container again to compare it with the archive, archives
+ * that come from a trusted source, for example protected by a checksum, can
+ * skip it.
+ */
+struct verify_policy
+{
+    enum mode_t
+    {
+        // Walk the whole loaded container.
+        full,
+        // Only check the root and the tail of a vector.
+        structural,
+        // Fully check one container out of every sample_period, and only the
+        // structure of the others.
+        sampled,
+        // No extra checks.
+        none,
+    };
+
+    mode_t mode               = full;
+    std::size_t sample_period = 16;
+};
+
+namespace detail {
+
+enum class verify_depth
+{
+    none,
+    structure,
+    full,
+};
+
+/**
+ * Tell the loaders how much to check each container they load, following the
+ * policy.
+ */
+class verifier
+{
+public:
+    explicit verifier(verify_policy policy = {})
+        : policy_{policy}
+    {
+    }
+
+    verify_depth next()
+    {
+        switch (policy_.mode) {
+        case verify_policy::structural:
+            return verify_depth::structure;
+        case verify_policy::sampled:
+            return count_++ % std::max(policy_.sample_period, std::size_t{1})
+                       ? verify_depth::structure
+                       : verify_depth::full;
+        case verify_policy::none:
+            return verify_depth::none;
+        case verify_policy::full:
+        default:
+            return verify_depth::full;
+        }
+    }
+
+private:
+    verify_policy policy_;
+    std::size_t count_ = 0;
+};
+
+} // namespace detail
+} // namespace immer_archive
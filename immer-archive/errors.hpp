@@ -51,4 +51,14 @@ public:
     }
 };
 
+class invalid_delta_archive : public archive_exception
+{
+public:
+    explicit invalid_delta_archive(const std::string& reason)
+        : archive_exception{fmt::format(
+              "Delta archive doesn't apply to the base archive: {}", reason)}
+    {
+    }
+};
+
 } // namespace immer_archive
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <immer-archive/common/lazy_archives.hpp>
+#include <immer-archive/json/json_input_reader.hpp>
+
 #include <cereal/archives/json.hpp>
 
+#include <memory>
+#include <string>
+
 /**
  * Special types of archives, working with JSON, that support providing extra
  * context (ImmerArchives) to serialize immer data structures using
@@ -70,7 +76,21 @@ public:
     json_immer_input_archive(ImmerArchives archives_, Args&&... args)
         : cereal::InputArchive<json_immer_input_archive<ImmerArchives>>{this}
         , archive{std::forward<Args>(args)...}
-        , archives{std::move(archives_)}
+        , own_archives{std::move(archives_)}
+        , archives{&own_archives}
+    {
+    }
+
+    /**
+     * Read another part of the same document, sharing the immer archives with
+     * the parent archive.
+     */
+    json_immer_input_archive(json_immer_input_archive& parent,
+                             json_input_reader reader)
+        : cereal::InputArchive<json_immer_input_archive<ImmerArchives>>{this}
+        , archive{std::move(reader)}
+        , archives{parent.archives}
+        , lazy_archives{parent.lazy_archives}
     {
     }
 
@@ -86,11 +106,61 @@ public:
         archive.loadValue(value);
     }
 
-    ImmerArchives& get_input_archives() { return archives; }
+    ImmerArchives& get_input_archives() { return *archives; }
+
+    /**
+     * Load the immer archives from the member of the document with the given
+     * name only when they are needed: an archive is loaded the first time a
+     * loader for its type is requested. If loading an archive requires other
+     * archives, they get loaded first, so that every archive is read exactly
+     * once.
+     */
+    void load_archives_lazily(const char* name)
+    {
+        lazy_archives = std::make_shared<lazy_archives_t>(lazy_archives_t{
+            .reader = archive.get_member_reader(name),
+        });
+    }
+
+    template <class Container>
+    auto& get_loader()
+    {
+        if (lazy_archives) {
+            load_archive<Container>();
+        }
+        return archives->template get_loader<Container>();
+    }
 
 private:
-    cereal::JSONInputArchive archive;
-    ImmerArchives archives;
+    struct lazy_archives_t
+    {
+        json_input_reader reader;
+        detail::lazy_archives_tracker tracker;
+    };
+
+    template <class Container>
+    void load_archive()
+    {
+        const auto name =
+            std::string{ImmerArchives::template get_name<Container>()};
+        lazy_archives->tracker.load_once(name, [&] {
+            auto& archive_load =
+                archives->template get_load_archive<Container>();
+            try {
+                auto ar =
+                    json_immer_input_archive{*this, lazy_archives->reader};
+                ar(cereal::make_nvp(name.c_str(), archive_load));
+            } catch (...) {
+                archive_load = {};
+                throw;
+            }
+        });
+    }
+
+    json_input_reader archive;
+    ImmerArchives own_archives;
+    ImmerArchives* archives;
+    std::shared_ptr<lazy_archives_t> lazy_archives;
 };
 
 /**
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <cereal/archives/json.hpp>
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace immer_archive {
+
+/**
+ * Reads values from a parsed JSON document, the same way
+ * cereal::JSONInputArchive does. Unlike cereal::JSONInputArchive, the document
+ * is parsed only once and can be shared between several readers, each one
+ * positioned on a different object of the document.
+ *
+ * Adapted from cereal/archives/json.hpp
+ */
+class json_input_reader
+{
+public:
+    using document_t = CEREAL_RAPIDJSON_NAMESPACE::Document;
+    using value_t    = document_t::ValueType;
+
+    explicit json_input_reader(std::istream& stream)
+    {
+        auto parsed      = std::make_shared<document_t>();
+        auto read_stream = CEREAL_RAPIDJSON_NAMESPACE::IStreamWrapper{stream};
+        parsed->ParseStream<>(read_stream);
+        if (parsed->HasParseError()) {
+            throw ::cereal::Exception{
+                fmt::format("JSON parsing failed at offset {}",
+                            parsed->GetErrorOffset())};
+        }
+        document = std::move(parsed);
+        enter_root(*document);
+    }
+
+    /**
+     * Read the given object or array, which must belong to the document.
+     */
+    json_input_reader(std::shared_ptr<const document_t> document_,
+                      const value_t& root_)
+        : document{std::move(document_)}
+    {
+        enter_root(root_);
+    }
+
+    /**
+     * Return a reader for the member with the given name of the object the
+     * reader is currently positioned on.
+     */
+    json_input_reader get_member_reader(const char* name)
+    {
+        setNextName(name);
+        search();
+        return json_input_reader{document, iterators.back().value()};
+    }
+
+    void startNode()
+    {
+        search();
+        const auto& value = iterators.back().value();
+        if (value.IsArray()) {
+            iterators.emplace_back(value.Begin(), value.End());
+        } else {
+            iterators.emplace_back(value.MemberBegin(), value.MemberEnd());
+        }
+    }
+
+    void finishNode()
+    {
+        iterators.pop_back();
+        ++iterators.back();
+    }
+
+    void setNextName(const char* name) { next_name = name; }
+
+    bool hasName(const char* name) { return iterators.back().has_name(name); }
+
+    void loadSize(cereal::size_type& size)
+    {
+        if (iterators.size() == 1) {
+            size = root->Size();
+        } else {
+            size = (iterators.rbegin() + 1)->value().Size();
+        }
+    }
+
+    template <class T,
+              cereal::traits::EnableIf<std::is_arithmetic<T>::value> =
+                  cereal::traits::sfinae>
+    void loadValue(T& value)
+    {
+        search();
+        const auto& json = iterators.back().value();
+        if constexpr (std::is_same_v<T, bool>) {
+            value = json.GetBool();
+        } else if constexpr (std::is_floating_point_v<T>) {
+            value = static_cast<T>(json.GetDouble());
+        } else if constexpr (std::is_signed_v<T>) {
+            value = static_cast<T>(json.GetInt64());
+        } else {
+            value = static_cast<T>(json.GetUint64());
+        }
+        ++iterators.back();
+    }
+
+    void loadValue(std::string& value)
+    {
+        search();
+        const auto& json = iterators.back().value();
+        value.assign(json.GetString(), json.GetStringLength());
+        ++iterators.back();
+    }
+
+    void loadValue(std::nullptr_t&)
+    {
+        search();
+        if (!iterators.back().value().IsNull()) {
+            throw ::cereal::Exception{"JSON value is expected to be null"};
+        }
+        ++iterators.back();
+    }
+
+private:
+    using member_iterator = value_t::ConstMemberIterator;
+    using value_iterator  = value_t::ConstValueIterator;
+
+    /**
+     * Iterates over either the members of an object or the values of an array.
+     */
+    class iterator
+    {
+    public:
+        iterator(member_iterator begin, member_iterator end)
+            : members{begin}
+            , size{static_cast<std::size_t>(std::distance(begin, end))}
+            , type{size ? type_t::member : type_t::empty}
+        {
+        }
+
+        iterator(value_iterator begin, value_iterator end)
+            : values{begin}
+            , size{static_cast<std::size_t>(std::distance(begin, end))}
+            , type{size ? type_t::value : type_t::empty}
+        {
+        }
+
+        iterator& operator++()
+        {
+            ++index;
+            return *this;
+        }
+
+        const value_t& value() const
+        {
+            if (index >= size) {
+                throw ::cereal::Exception{"No more objects in input"};
+            }
+            switch (type) {
+            case type_t::value:
+                return values[index];
+            case type_t::member:
+                return members[index].value;
+            default:
+                throw ::cereal::Exception{
+                    "json_input_reader internal error: null or empty "
+                    "iterator to object or array!"};
+            }
+        }
+
+        const char* name() const
+        {
+            if (type == type_t::member && index < size) {
+                return members[index].name.GetString();
+            }
+            return nullptr;
+        }
+
+        bool has_name(const char* name) const { return find(name) < size; }
+
+        void search(const char* name)
+        {
+            const auto found = find(name);
+            if (found == size) {
+                throw ::cereal::Exception{
+                    fmt::format("JSON Parsing failed - provided NVP ({}) not "
+                                "found",
+                                name)};
+            }
+            index = found;
+        }
+
+    private:
+        std::size_t find(const char* name) const
+        {
+            if (type != type_t::member) {
+                return size;
+            }
+            for (auto i = std::size_t{}; i < size; ++i) {
+                if (std::strcmp(name, members[i].name.GetString()) == 0) {
+                    return i;
+                }
+            }
+            return size;
+        }
+
+        enum class type_t
+        {
+            value,
+            member,
+            empty,
+        };
+
+        member_iterator members = {};
+        value_iterator values   = {};
+        std::size_t index       = 0;
+        std::size_t size        = 0;
+        type_t type             = type_t::empty;
+    };
+
+    void enter_root(const value_t& root_)
+    {
+        root = &root_;
+        if (root->IsArray()) {
+            iterators.emplace_back(root->Begin(), root->End());
+        } else if (root->IsObject()) {
+            iterators.emplace_back(root->MemberBegin(), root->MemberEnd());
+        } else {
+            throw ::cereal::Exception{
+                "JSON value is expected to be an object or an array"};
+        }
+    }
+
+    /**
+     * Position the current iterator on the member with the pending name, if
+     * any.
+     */
+    void search()
+    {
+        // Reset the name before searching in case the search throws.
+        const auto* name = next_name;
+        next_name        = nullptr;
+        if (name) {
+            const auto* actual_name = iterators.back().name();
+            if (!actual_name || std::strcmp(name, actual_name) != 0) {
+                iterators.back().search(name);
+            }
+        }
+    }
+
+    std::shared_ptr<const document_t> document;
+    const value_t* root = nullptr;
+    std::vector<iterator> iterators;
+    const char* next_name = nullptr;
+};
+
+} // namespace immer_archive
@@ -1,11 +1,11 @@
 #pragma once
 
+#include <immer-archive/archives.hpp>
+#include <immer-archive/common/counting_streambuf.hpp>
 #include <immer-archive/json/json_immer.hpp>
-#include <immer-archive/traits.hpp>
 
-#include <boost/hana.hpp>
-
-#include <optional>
+#include <ostream>
+#include <sstream>
 
 /**
  * to_json_with_archive
@@ -13,169 +13,19 @@
 
 namespace immer_archive {
 
-namespace detail {
-
-namespace hana = boost::hana;
-
-/**
- * Unimplemented class to generate a compile-time error and show what the type T
- * is.
- */
-template <class T>
-class error_no_archive_for_the_given_type_check_get_archives_types_function;
-
-/**
- * Archives and functions to serialize types that contain immer-archivable data
- * structures.
- */
-template <class Storage, class Names>
-struct archives_save
-{
-    using names_t = Names;
-
-    Storage storage;
-
-    template <class Archive>
-    void save(Archive& ar) const
-    {
-        constexpr auto keys = hana::keys(names_t{});
-        hana::for_each(keys, [&](auto key) {
-            constexpr auto name = names_t{}[key];
-            ar(cereal::make_nvp(name.c_str(), storage[key]));
-        });
-    }
-
-    template <class T>
-    auto& get_save_archive()
-    {
-        using Contains = decltype(hana::contains(storage, hana::type_c<T>));
-        constexpr bool contains = hana::value<Contains>();
-        if constexpr (!contains) {
-            auto err =
-                error_no_archive_for_the_given_type_check_get_archives_types_function<
-                    T>{};
-        }
-        return storage[hana::type_c<T>];
-    }
-};
-
-template <class Container>
-struct archive_type_load
-{
-    typename container_traits<Container>::load_archive_t archive = {};
-    std::optional<typename container_traits<Container>::loader_t> loader;
-
-    archive_type_load() = default;
-
-    archive_type_load(const archive_type_load& other)
-        : archive{other.archive}
-    {
-    }
-
-    archive_type_load& operator=(const archive_type_load& other)
-    {
-        archive = other.archive;
-        return *this;
-    }
-
-    friend bool operator==(const archive_type_load& left,
-                           const archive_type_load& right)
-    {
-        return left.archive == right.archive;
-    }
-};
-
-template <class Storage, class Names>
-struct archives_load
-{
-    using names_t = Names;
-
-    Storage storage;
-
-    template <class Container>
-    auto& get_loader()
-    {
-        auto& load = storage[hana::type_c<Container>];
-        if (!load.loader) {
-            load.loader.emplace(load.archive);
-        }
-        return *load.loader;
-    }
-
-    template <class Archive>
-    void load(Archive& ar)
-    {
-        constexpr auto keys = hana::keys(names_t{});
-        hana::for_each(keys, [&](auto key) {
-            constexpr auto name = names_t{}[key];
-            ar(cereal::make_nvp(name.c_str(), storage[key].archive));
-        });
-    }
-
-    friend bool operator==(const archives_load& left,
-                           const archives_load& right)
-    {
-        return left.storage == right.storage;
-    }
-};
-
-inline auto generate_archives_save(auto type_names)
-{
-    auto storage =
-        hana::fold_left(type_names, hana::make_map(), [](auto map, auto pair) {
-            using Type = typename decltype(+hana::first(pair))::type;
-            return hana::insert(
-                map,
-                hana::make_pair(
-                    hana::first(pair),
-                    typename container_traits<Type>::save_archive_t{}));
-        });
-
-    using Storage = decltype(storage);
-    using Names   = decltype(type_names);
-    return archives_save<Storage, Names>{storage};
-}
-
-inline auto generate_archives_load(auto type_names)
-{
-    auto storage =
-        hana::fold_left(type_names, hana::make_map(), [](auto map, auto pair) {
-            using Type = typename decltype(+hana::first(pair))::type;
-            return hana::insert(
-                map,
-                hana::make_pair(hana::first(pair), archive_type_load<Type>{}));
-        });
-
-    using Storage = decltype(storage);
-    using Names   = decltype(type_names);
-    return archives_load<Storage, Names>{storage};
-}
-
-} // namespace detail
-
-template <class T>
-auto get_archives_types(const T&)
-{
-    return boost::hana::make_map();
-}
-
-template <class Archives>
-constexpr bool is_archive_empty(const Archives& archives)
-{
-    using Result =
-        decltype(boost::hana::is_empty(boost::hana::keys(archives.storage)));
-    return boost::hana::value<Result>();
-}
-
 /**
  * Type T must provide a callable free function get_archives_types(const T&).
+ *
+ * The value is written into the stream as it is serialized, followed by the
+ * archives, so the output is never kept in memory. Only the archives are, and
+ * they reference the nodes of the serialized containers instead of copying
+ * them. Return the archives.
  */
 template <typename T>
-auto to_json_with_archive(const T& serializable)
+auto to_json_with_archive(std::ostream& os, const T& serializable)
 {
     auto archives =
         detail::generate_archives_save(get_archives_types(serializable));
-    auto os = std::ostringstream{};
     {
         auto ar =
             immer_archive::json_immer_output_archive<decltype(archives)>{os};
@@ -183,7 +33,11 @@ auto to_json_with_archive(const T& serializable)
         archives = ar.get_output_archives();
 
         {
-            auto os2 = std::ostringstream{};
+            // Saving the archives may add more nodes into other archives (when
+            // archived containers contain other archivable containers),
+            // collect them without keeping the output.
+            auto discard = detail::counting_streambuf{};
+            auto os2     = std::ostream{&discard};
             auto ar2 =
                 immer_archive::json_immer_output_archive<decltype(archives)>{
                     archives, os2};
@@ -196,50 +50,42 @@ auto to_json_with_archive(const T& serializable)
             ar.finalize();
         }
     }
+    return archives;
+}
+
+/**
+ * Type T must provide a callable free function get_archives_types(const T&).
+ */
+template <typename T>
+auto to_json_with_archive(const T& serializable)
+{
+    auto os       = std::ostringstream{};
+    auto archives = to_json_with_archive(os, serializable);
     return std::make_pair(os.str(), std::move(archives));
 }
 
+/**
+ * The verify policy applies to all the containers loaded from the archives.
+ * Containers with a pool in pools share their nodes with the ones restored
+ * with the same pools before, see node_pools.
+ */
 template <typename T>
-T from_json_with_archive(const std::string& input)
+T from_json_with_archive(const std::string& input,
+                         verify_policy verify              = {},
+                         std::shared_ptr<node_pools> pools = {})
 {
     using Archives = std::decay_t<decltype(detail::generate_archives_load(
         get_archives_types(std::declval<T>())))>;
     auto archives  = Archives{};
 
-    if constexpr (!is_archive_empty(archives)) {
-        {
-            auto is = std::istringstream{input};
-            auto ar = cereal::JSONInputArchive{is};
-            ar(CEREAL_NVP(archives));
-        }
-
-        const auto reload_archive = [&] {
-            auto is = std::istringstream{input};
-            auto ar =
-                immer_archive::json_immer_input_archive<Archives>{archives, is};
-            /**
-             * NOTE: Critical to clear the archives before loading into it
-             * again. I hit a bug when archives contained a vector and every
-             * load would append to it, instead of replacing the contents.
-             */
-            archives = {};
-            ar(CEREAL_NVP(archives));
-        };
-
-        auto prev = archives;
-        while (true) {
-            // Keep reloading until everything is loaded.
-            reload_archive();
-            if (prev == archives) {
-                break;
-            }
-            prev = archives;
-        }
-    }
+    archives.verify = verify;
+    archives.pools  = std::move(pools);
 
     auto is = std::istringstream{input};
-    auto ar = immer_archive::json_immer_input_archive<Archives>{
-        std::move(archives), is};
+    auto ar = immer_archive::json_immer_input_archive<Archives>{archives, is};
+    if constexpr (!is_archive_empty(archives)) {
+        ar.load_archives_lazily("archives");
+    }
     auto r = T{};
     ar(r);
     return r;
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <immer-archive/traits.hpp>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <typeindex>
+#include <unordered_map>
+
+namespace immer_archive {
+
+/**
+ * Whether the loaders of a container can share their nodes through a pool,
+ * see rbts::node_pool. Only vectors and flex vectors have one so far.
+ */
+template <class Container>
+concept has_node_pool = requires {
+    typename container_traits<Container>::node_pool_t;
+    typename container_traits<Container>::loader_t::pool_t;
+};
+
+/**
+ * The node pools given to the loaders of the archives, so that restoring
+ * several values that have nodes with the same contents gives them the same
+ * nodes. Containers get a pool once it's added for their type, containers
+ * with the same type of nodes share it. Like the pools, it's not thread-safe.
+ *
+ * Only vectors and flex vectors can be given a pool. The champ containers,
+ * immer::map, immer::set and immer::table, have none: restoring them twice
+ * still gives them separate nodes, and add() doesn't compile for them.
+ * Neither do boxes and arrays.
+ */
+class node_pools
+{
+public:
+    template <has_node_pool Container>
+    void add()
+    {
+        using pool_t = typename container_traits<Container>::node_pool_t;
+        using base_t = typename container_traits<Container>::loader_t::pool_t;
+
+        auto& entry = pools_[typeid(base_t)];
+        if (!entry.pool) {
+            auto pool  = std::make_shared<pool_t>();
+            entry.trim = [pool = pool.get()] { return pool->trim(); };
+            entry.pool = std::shared_ptr<base_t>{std::move(pool)};
+        }
+    }
+
+    /**
+     * Return the pool for the nodes of the container, or nullptr when none
+     * has been added.
+     */
+    template <has_node_pool Container>
+    auto find() const
+    {
+        using base_t = typename container_traits<Container>::loader_t::pool_t;
+
+        const auto it = pools_.find(typeid(base_t));
+        return it == pools_.end()
+                   ? std::shared_ptr<base_t>{}
+                   : std::static_pointer_cast<base_t>(it->second.pool);
+    }
+
+    /**
+     * Trim all the pools, see rbts::node_pool::trim().
+     */
+    std::size_t trim()
+    {
+        auto trimmed = std::size_t{};
+        for (auto& [type, entry] : pools_) {
+            trimmed += entry.trim();
+        }
+        return trimmed;
+    }
+
+private:
+    struct pool_entry
+    {
+        std::shared_ptr<void> pool;
+        std::function<std::size_t()> trim;
+    };
+
+    std::unordered_map<std::type_index, pool_entry> pools_;
+};
+
+} // namespace immer_archive
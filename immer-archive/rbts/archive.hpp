@@ -4,6 +4,7 @@
 #include <immer-archive/cereal/immer_map.hpp>
 #include <immer-archive/cereal/immer_vector.hpp>
 #include <immer-archive/common/archive.hpp>
+#include <immer-archive/errors.hpp>
 
 #include <immer/array.hpp>
 #include <immer/flex_vector.hpp>
@@ -65,6 +66,13 @@ struct archive_save
     immer::map<rbts_info, container_id> rbts_to_id;
     immer::map<const void*, node_id> node_ptr_to_id;
 
+    // Only used by save_to_archive_deduplicated: the IDs of the nodes saved
+    // that way by the hash of their contents, and the nodes that were merged
+    // into another node with the same contents. Each ID has exactly one node
+    // in node_ptr_to_id.
+    immer::map<std::size_t, immer::vector<node_id>> content_to_ids;
+    immer::map<const void*, node_id> merged_node_ptr_to_id;
+
     // Saving the archived vectors, so that no mutations are allowed to happen.
     immer::vector<immer::vector<T, MemoryPolicy, B, BL>> saved_vectors;
     immer::vector<immer::flex_vector<T, MemoryPolicy, B, BL>>
@@ -137,6 +145,139 @@ archive_load<T> fix_leaf_nodes(archive_save<T, MemoryPolicy, B, BL> ar)
     };
 }
 
+/**
+ * The part of an archive that was added on top of a base archive. Saving new
+ * containers into a copy of a previous archive_save keeps the IDs of the
+ * nodes it already knows and numbers the new nodes after them, so only the
+ * nodes and vectors with the newer IDs need to be written.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+struct archive_delta_save
+{
+    archive_save<T, MemoryPolicy, B, BL> archive;
+    std::size_t base_nodes   = 0;
+    std::size_t base_vectors = 0;
+
+    template <class Archive>
+    void save(Archive& ar) const
+    {
+        // Node IDs are dense, look up the new ones instead of going through
+        // the whole archive.
+        auto leaves = immer::map<node_id, values_save<T>>{}.transient();
+        auto inners = immer::map<node_id, inner_node>{}.transient();
+        for (auto index = base_nodes; index < archive.node_ptr_to_id.size();
+             ++index) {
+            const auto id = node_id{index};
+            if (auto* leaf = archive.leaves.find(id)) {
+                leaves.set(id, *leaf);
+            } else if (auto* inner = archive.inners.find(id)) {
+                inners.set(id, *inner);
+            }
+        }
+
+        auto vectors = immer::vector<rbts_info>{}.transient();
+        for (auto index = base_vectors; index < archive.vectors.size();
+             ++index) {
+            vectors.push_back(archive.vectors[index]);
+        }
+
+        ar(CEREAL_NVP(base_nodes),
+           CEREAL_NVP(base_vectors),
+           cereal::make_nvp("leaves", std::move(leaves).persistent()),
+           cereal::make_nvp("inners", std::move(inners).persistent()),
+           cereal::make_nvp("vectors", std::move(vectors).persistent()));
+    }
+};
+
+/**
+ * Describe what was added to the archive since base was saved. The archive must
+ * have been obtained by saving more containers into base.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+archive_delta_save<T, MemoryPolicy, B, BL>
+make_delta(const archive_save<T, MemoryPolicy, B, BL>& base,
+           archive_save<T, MemoryPolicy, B, BL> archive)
+{
+    assert(base.node_ptr_to_id.size() <= archive.node_ptr_to_id.size());
+    assert(base.vectors.size() <= archive.vectors.size());
+    return {
+        .archive      = std::move(archive),
+        .base_nodes   = base.node_ptr_to_id.size(),
+        .base_vectors = base.vectors.size(),
+    };
+}
+
+template <typename T>
+struct archive_delta_load
+{
+    archive_load<T> archive;
+    std::size_t base_nodes   = 0;
+    std::size_t base_vectors = 0;
+
+    template <class Archive>
+    void load(Archive& ar)
+    {
+        ar(CEREAL_NVP(base_nodes),
+           CEREAL_NVP(base_vectors),
+           cereal::make_nvp("leaves", archive.leaves),
+           cereal::make_nvp("inners", archive.inners),
+           cereal::make_nvp("vectors", archive.vectors));
+    }
+};
+
+/**
+ * Add the nodes and vectors of the delta to the base archive. A chain of
+ * deltas is applied one by one, in the order they were saved. The cost is
+ * proportional to the size of the delta.
+ */
+template <typename T>
+archive_load<T> apply_delta(archive_load<T> base,
+                            const archive_delta_load<T>& delta)
+{
+    if (base.leaves.size() + base.inners.size() != delta.base_nodes) {
+        throw invalid_delta_archive{"the number of nodes doesn't match"};
+    }
+    if (base.vectors.size() != delta.base_vectors) {
+        throw invalid_delta_archive{"the number of vectors doesn't match"};
+    }
+
+    const auto check_id = [&](node_id id) {
+        if (id.value < delta.base_nodes) {
+            throw invalid_delta_archive{
+                fmt::format("node ID {} belongs to the base archive", id)};
+        }
+    };
+
+    auto leaves = std::move(base.leaves).transient();
+    for (const auto& [id, leaf] : delta.archive.leaves) {
+        check_id(id);
+        leaves.set(id, leaf);
+    }
+
+    auto inners = std::move(base.inners).transient();
+    for (const auto& [id, inner] : delta.archive.inners) {
+        check_id(id);
+        inners.set(id, inner);
+    }
+
+    auto vectors = std::move(base.vectors).transient();
+    for (const auto& info : delta.archive.vectors) {
+        vectors.push_back(info);
+    }
+
+    return {
+        .leaves  = std::move(leaves).persistent(),
+        .inners  = std::move(inners).persistent(),
+        .vectors = std::move(vectors).persistent(),
+    };
+}
+
 } // namespace immer_archive::rbts
 
 namespace std {
@@ -1,15 +1,22 @@
 #pragma once
 
+#include <immer-archive/common/parallel.hpp>
+#include <immer-archive/common/verify_policy.hpp>
 #include <immer-archive/errors.hpp>
-#include <immer-archive/node_ptr.hpp>
 #include <immer-archive/rbts/archive.hpp>
+#include <immer-archive/rbts/node_pool.hpp>
 #include <immer-archive/rbts/traverse.hpp>
 
 #include <boost/hana.hpp>
 #include <boost/range/adaptor/indexed.hpp>
-#include <immer/set.hpp>
 #include <immer/vector.hpp>
+#include <cstring>
+#include <memory>
 #include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
@@ -88,14 +95,95 @@ public:
     using rbtree      = immer::detail::rbts::rbtree<T, MemoryPolicy, B, BL>;
     using rrbtree     = immer::detail::rbts::rrbtree<T, MemoryPolicy, B, BL>;
     using node_t      = typename rbtree::node_t;
-    using node_ptr    = node_ptr<node_t>;
-    using nodes_set_t = immer::set<node_id>;
-
-    explicit loader(archive_load<T> ar)
+    using pool_t      = node_pool_base<T, MemoryPolicy, B, BL>;
+
+    /**
+     * Loaders given the same pool share the nodes they create with each
+     * other, see node_pool.
+     */
+    explicit loader(archive_load<T> ar,
+                    verify_policy verify         = {},
+                    std::shared_ptr<pool_t> pool = {})
         : ar_{std::move(ar)}
+        , entries_(ar_.leaves.size() + ar_.inners.size())
+        , verifier_{verify}
+        , pool_{std::move(pool)}
+    {
+        for (const auto& [id, info] : ar_.leaves) {
+            get_entry(id).leaf_info = values_save<T>{
+                .begin = info.data.data(),
+                .end   = info.data.data() + info.data.size(),
+            };
+        }
+        add_inner_entries();
+    }
+
+    /**
+     * Load the vectors of an archive that is still in memory, without going
+     * through archive_load. The leaves are read from the nodes of the saved
+     * vectors, which the loader keeps alive, so no values are copied apart
+     * from the ones going into the loaded leaves. The saved vectors may use
+     * another memory policy than the loaded ones.
+     */
+    template <typename SourceMemoryPolicy>
+    explicit loader(archive_save<T, SourceMemoryPolicy, B, BL> ar,
+                    verify_policy verify         = {},
+                    std::shared_ptr<pool_t> pool = {})
+        : ar_{.inners = ar.inners, .vectors = ar.vectors}
+        , entries_(ar.leaves.size() + ar.inners.size())
+        , verifier_{verify}
+        , pool_{std::move(pool)}
+    {
+        for (const auto& [id, info] : ar.leaves) {
+            get_entry(id).leaf_info = info;
+        }
+        add_inner_entries();
+
+        using saved_t = archive_save<T, SourceMemoryPolicy, B, BL>;
+        saved_        = std::make_shared<const saved_t>(std::move(ar));
+    }
+
+    loader(const loader&)            = delete;
+    loader& operator=(const loader&) = delete;
+
+    loader(loader&& other)
+        : ar_{other.ar_}
+        , saved_{other.saved_}
+        , entries_{std::exchange(other.entries_, {})}
+        , sparse_entries_{std::exchange(other.sparse_entries_, {})}
+        , node_ids_{std::exchange(other.node_ids_, {})}
+        , verifier_{other.verifier_}
+        , pool_{other.pool_}
     {
     }
 
+    /**
+     * The loader keeps one reference to every node it has loaded, so that
+     * loading the same node ID again gives the same node. Nodes are regular
+     * immer nodes: children are referenced by their parents, and the vectors
+     * built from them free them the normal way. The nodes that are in a pool
+     * are also referenced by the pool, which the loader keeps alive.
+     */
+    ~loader()
+    {
+        const auto release_entry = [this](const node_entry& entry) {
+            if (entry.inner) {
+                release(entry.inner);
+            }
+            if (entry.leaf) {
+                release(entry.leaf);
+            }
+        };
+        for (const auto& entry : entries_) {
+            release_entry(entry);
+        }
+        for (const auto& [id, entry] : sparse_entries_) {
+            release_entry(entry);
+        }
+    }
+
+    std::size_t containers_count() const { return ar_.vectors.size(); }
+
     immer::vector<T, MemoryPolicy, B, BL> load_vector(container_id id)
     {
         if (id.value >= ar_.vectors.size()) {
@@ -105,20 +193,21 @@ public:
         const auto& info = ar_.vectors[id.value];
 
         const auto relaxed_allowed = false;
-        auto root                  = load_inner(info.root, {}, relaxed_allowed);
+        auto root                  = load_inner(info.root, relaxed_allowed);
         auto tail                  = load_leaf(info.tail);
 
         const auto tree_size =
             get_node_size(info.root) + get_node_size(info.tail);
         const auto depth = get_node_depth(info.root);
         const auto shift = get_shift_for_depth(B, BL, depth);
+        check_regular_root(info.root, info.tail, tree_size);
 
-        auto impl = rbtree{tree_size,
-                           shift,
-                           std::move(root).release(),
-                           std::move(tail).release()};
+        // The loader keeps its own references to the nodes.
+        root->inc();
+        tail->inc();
+        auto impl = rbtree{tree_size, shift, root, tail};
 
-        verify_tree(impl);
+        verify(impl);
         return impl;
     }
 
@@ -131,68 +220,262 @@ public:
         const auto& info = ar_.vectors[id.value];
 
         const auto relaxed_allowed = true;
-        auto root                  = load_inner(info.root, {}, relaxed_allowed);
+        auto root                  = load_inner(info.root, relaxed_allowed);
         auto tail                  = load_leaf(info.tail);
 
         const auto tree_size =
             get_node_size(info.root) + get_node_size(info.tail);
         const auto depth = get_node_depth(info.root);
         const auto shift = get_shift_for_depth(B, BL, depth);
+        if (!get_entry(info.root).inner_relaxed) {
+            check_regular_root(info.root, info.tail, tree_size);
+        }
 
-        auto impl = rrbtree{tree_size,
-                            shift,
-                            std::move(root).release(),
-                            std::move(tail).release()};
+        root->inc();
+        tail->inc();
+        auto impl = rrbtree{tree_size, shift, root, tail};
 
-        verify_tree(impl);
+        verify(impl);
 
         return impl;
     }
 
+    /**
+     * Create, using the given number of threads, the leaves of the archive
+     * that have not been loaded yet. Leaves don't reference other nodes, so
+     * they are created independently of each other, and the vectors loaded
+     * afterwards only have to assemble their inner nodes.
+     *
+     * The heap of MemoryPolicy must support allocating from several threads,
+     * which is the case of immer's default heap. Invalid leaves are skipped
+     * here and reported when a vector that uses them is loaded. The pool, if
+     * any, is only used from the calling thread.
+     */
+    void preload_leaves(std::size_t threads)
+    {
+        constexpr auto max_n = immer::detail::rbts::branches<BL>;
+
+        auto pending     = std::vector<std::pair<node_id, values_save<T>>>{};
+        const auto visit = [&](std::size_t id, const node_entry& entry) {
+            if (entry.leaf_info && !entry.leaf &&
+                entry.leaf_info->size() <= max_n) {
+                pending.emplace_back(node_id{id}, *entry.leaf_info);
+            }
+        };
+        for (auto id = std::size_t{}; id < entries_.size(); ++id) {
+            visit(id, entries_[id]);
+        }
+        for (const auto& [id, entry] : sparse_entries_) {
+            visit(id, entry);
+        }
+
+        auto leaves = std::vector<node_t*>(pending.size());
+        try {
+            detail::parallel_for(
+                pending.size(), threads, [&](std::size_t index) {
+                    leaves[index] = make_leaf(pending[index].second);
+                });
+        } catch (...) {
+            for (const auto& [index, leaf] : boost::adaptors::index(leaves)) {
+                if (leaf) {
+                    node_t::delete_leaf(leaf, pending[index].second.size());
+                }
+            }
+            throw;
+        }
+
+        for (const auto& [index, leaf] : boost::adaptors::index(leaves)) {
+            const auto& [id, info] = pending[index];
+            if (auto* pooled = pool_ ? pool_->find_leaf(info) : nullptr) {
+                node_t::delete_leaf(leaf, info.size());
+                pooled->inc();
+                add_leaf(id, pooled);
+                continue;
+            }
+            if (pool_) {
+                pool_->add_leaf(leaf, info.size());
+            }
+            add_leaf(id, leaf);
+        }
+    }
+
 private:
-    node_ptr load_leaf(node_id id)
+    /**
+     * What the loader knows about one node ID. Node IDs are dense, so the
+     * entries are stored in a vector indexed by ID.
+     */
+    struct node_entry
     {
-        if (auto* p = leaves_.find(id)) {
-            return *p;
+        // The same ID may be used both by a leaf and by an inner node in an
+        // invalid archive, they're kept apart.
+        std::optional<values_save<T>> leaf_info;
+        const inner_node* inner_info = nullptr;
+
+        node_t* leaf        = nullptr;
+        node_t* inner       = nullptr;
+        std::size_t inner_n = 0;
+        bool inner_relaxed  = false;
+
+        std::optional<std::size_t> size;
+        std::optional<immer::detail::rbts::count_t> depth;
+        // The children of an inner node without the empty ones, shared by
+        // loading and verifying.
+        std::optional<std::vector<node_id>> children;
+
+        // Cycles are detected by colouring the nodes: a node is grey while
+        // its children are being visited, and black once it's done, which is
+        // when its result is cached above. Meeting a grey node again means
+        // there's a cycle. Loading and computing sizes are separate walks.
+        bool loading = false;
+        bool sizing  = false;
+    };
+
+    /**
+     * Keep a node grey while it's being visited, also when visiting its
+     * children throws.
+     */
+    class grey_guard
+    {
+    public:
+        explicit grey_guard(bool& grey)
+            : grey_{grey}
+        {
+            grey_ = true;
         }
 
-        auto* node_info = ar_.leaves.find(id);
-        if (!node_info) {
+        grey_guard(const grey_guard&)            = delete;
+        grey_guard& operator=(const grey_guard&) = delete;
+
+        ~grey_guard() { grey_ = false; }
+
+    private:
+        bool& grey_;
+    };
+
+    /**
+     * Entries are created for all the nodes of the archive upfront, and never
+     * move afterwards.
+     */
+    node_entry& get_entry(node_id id)
+    {
+        // IDs past the number of nodes only appear in hand-made archives, they
+        // don't get to decide the size of the vector.
+        if (id.value < entries_.size()) {
+            return entries_[id.value];
+        }
+        return sparse_entries_[id.value];
+    }
+
+    /**
+     * Return the entry of a node ID that the archive contains, or nullptr.
+     */
+    node_entry* find_entry(node_id id)
+    {
+        auto* entry = [&]() -> node_entry* {
+            if (id.value < entries_.size()) {
+                return &entries_[id.value];
+            }
+            auto it = sparse_entries_.find(id.value);
+            return it == sparse_entries_.end() ? nullptr : &it->second;
+        }();
+        return entry && (entry->leaf_info || entry->inner_info) ? entry
+                                                                : nullptr;
+    }
+
+    /**
+     * Drop a reference to a loaded node and free it, together with its
+     * children that are not referenced anymore, the same way immer would.
+     */
+    void release(node_t* node)
+    {
+        if (!node->dec()) {
+            return;
+        }
+
+        const auto it = node_ids_.find(node);
+        assert(it != node_ids_.end() && "Releasing a node that was not loaded");
+        const auto& entry = get_entry(it->second);
+        if (entry.inner == node) {
+            for (auto i = std::size_t{}; i < entry.inner_n; ++i) {
+                release(node->inner()[i]);
+            }
+            if (entry.inner_relaxed) {
+                node_t::delete_inner_r(node, entry.inner_n);
+            } else {
+                node_t::delete_inner(node, entry.inner_n);
+            }
+        } else {
+            node_t::delete_leaf(node, entry.leaf_info->size());
+        }
+    }
+
+    node_t* load_leaf(node_id id)
+    {
+        auto* entry = find_entry(id);
+        if (entry && entry->leaf) {
+            return entry->leaf;
+        }
+
+        if (!entry || !entry->leaf_info) {
             throw invalid_node_id{id};
         }
 
-        const auto n         = node_info->data.size();
+        const auto& node_info = *entry->leaf_info;
+        const auto n          = node_info.size();
         constexpr auto max_n = immer::detail::rbts::branches<BL>;
         if (n > max_n) {
             throw invalid_children_count{id};
         }
 
-        auto leaf = node_ptr{node_t::make_leaf_n(n),
-                             [n](auto* ptr) { node_t::delete_leaf(ptr, n); }};
-        immer::detail::uninitialized_copy(
-            node_info->data.begin(), node_info->data.end(), leaf.get()->leaf());
-        leaves_        = std::move(leaves_).set(id, leaf);
-        loaded_leaves_ = std::move(loaded_leaves_).set(leaf.get(), id);
+        auto* leaf = [&] {
+            if (auto* pooled = pool_ ? pool_->find_leaf(node_info) : nullptr) {
+                pooled->inc();
+                return pooled;
+            }
+            auto* result = make_leaf(node_info);
+            if (pool_) {
+                pool_->add_leaf(result, n);
+            }
+            return result;
+        }();
+        add_leaf(id, leaf);
+        return leaf;
+    }
+
+    static node_t* make_leaf(const values_save<T>& info)
+    {
+        auto* leaf = node_t::make_leaf_n(info.size());
+        if constexpr (std::is_trivially_copyable_v<T>) {
+            std::memcpy(leaf->leaf(), info.begin, info.size() * sizeof(T));
+        } else {
+            immer::detail::uninitialized_copy(
+                info.begin, info.end, leaf->leaf());
+        }
         return leaf;
     }
 
-    node_ptr
-    load_inner(node_id id, nodes_set_t loading_nodes, bool relaxed_allowed)
+    void add_leaf(node_id id, node_t* leaf)
     {
-        if (loading_nodes.count(id)) {
+        get_entry(id).leaf = leaf;
+        node_ids_.emplace(leaf, id);
+    }
+
+    node_t* load_inner(node_id id, bool relaxed_allowed)
+    {
+        auto* entry = find_entry(id);
+        if (entry && entry->loading) {
             throw archive_has_cycles{id};
         }
-
-        if (auto* p = inners_.find(id)) {
-            return *p;
+        if (entry && entry->inner) {
+            return entry->inner;
         }
 
-        auto* node_info = ar_.inners.find(id);
+        const auto* node_info = entry ? entry->inner_info : nullptr;
         if (!node_info) {
             throw invalid_node_id{id};
         }
 
-        const auto children_ids = get_node_children(*node_info);
+        const auto& children_ids = get_node_children(*entry);
 
         const auto n         = children_ids.size();
         constexpr auto max_n = immer::detail::rbts::branches<B>;
@@ -214,154 +497,217 @@ private:
         }
 
         /**
-         * We have to have the same behavior of inner nodes deallocating
-         * children as vectors themselves, otherwise memory leaks appear.
-         *
-         * Specifically this: children's ref-counts must be decreased only when
-         * the inner node that references them is deleted.
+         * The children stay owned by the loader until they are linked into the
+         * new node below, so nothing leaks if loading them throws, for example
+         * when the same-depth validation doesn't pass.
          */
         const auto children = [&] {
-            /**
-             * NOTE: load_children may throw an exception if same-depth
-             * validation doesn't pass. Be careful with release_full, nodes will
-             * not be freed automatically.
-             */
-            auto children_ptrs =
-                load_children(id,
-                              children_ids,
-                              std::move(loading_nodes).insert(id),
-                              relaxed_allowed);
-            auto result = immer::vector<ptr_with_deleter<node_t>>{};
-            for (auto& item : children_ptrs) {
-                result =
-                    std::move(result).push_back(std::move(item).release_full());
+            const auto grey = grey_guard{entry->loading};
+            return load_children(id, children_ids, relaxed_allowed);
+        }();
+
+        if (!is_relaxed) {
+            for (auto i = std::size_t{}; i + 1 < n; ++i) {
+                check_full(children_ids[i]);
+            }
+        }
+
+        auto* inner = [&] {
+            if (auto* pooled =
+                    pool_ ? pool_->find_inner(children, is_relaxed) : nullptr) {
+                pooled->inc();
+                return pooled;
+            }
+            auto* result = make_inner(children, children_ids, is_relaxed);
+            if (pool_) {
+                pool_->add_inner(result, n, is_relaxed);
             }
             return result;
         }();
-        const auto delete_children = [children]() {
-            for (const auto& ptr : children) {
-                ptr.dec();
+
+        entry->inner         = inner;
+        entry->inner_n       = n;
+        entry->inner_relaxed = is_relaxed;
+        node_ids_.emplace(inner, id);
+        return inner;
+    }
+
+    /**
+     * immer finds the children of a regular node from the size of the tree,
+     * assuming that all of them but the last one are full. A shorter child
+     * would make it read past the end of a node, so this is checked while
+     * loading whatever the verify policy, on nodes that are already loaded.
+     */
+    void check_full(node_id id)
+    {
+        auto& entry = get_entry(id);
+        if (entry.leaf_info) {
+            constexpr auto max_n = immer::detail::rbts::branches<BL>;
+            const auto n         = entry.leaf_info->size();
+            if (n != max_n) {
+                throw vector_corrupted_exception{id, max_n, n};
             }
-        };
+            return;
+        }
 
-        auto inner = is_relaxed ? node_ptr{node_t::make_inner_r_n(n),
-                                           [n, delete_children](auto* ptr) {
-                                               node_t::delete_inner_r(ptr, n);
-                                               delete_children();
-                                           }}
-                                : node_ptr{node_t::make_inner_n(n),
-                                           [n, delete_children](auto* ptr) {
-                                               node_t::delete_inner(ptr, n);
-                                               delete_children();
-                                           }};
-        if (is_relaxed) {
-            inner.get()->relaxed()->d.count = n;
+        constexpr auto max_n = immer::detail::rbts::branches<B>;
+        const auto& children = get_node_children(entry);
+        if (children.size() != max_n) {
+            throw vector_corrupted_exception{id, max_n, children.size()};
         }
+        // The other children were checked when the node was loaded.
+        check_full(children.back());
+    }
 
-        {
-            auto running_size = std::size_t{};
-            for (const auto& [index, child_node_id] :
-                 boost::adaptors::index(children_ids)) {
-                inner.get()->inner()[index] = children[index].ptr;
-                if (is_relaxed) {
-                    running_size += get_node_size(child_node_id);
-                    inner.get()->relaxed()->d.sizes[index] = running_size;
-                }
+    /**
+     * immer also finds the tail of a vector with a regular root from the size
+     * of the tree, which must then leave only full leaves under the root. The
+     * children before the last one of each node are checked when the node is
+     * loaded, this checks the last ones down to the last leaf, and that the
+     * tail holds the rest of the values.
+     */
+    void check_regular_root(node_id root_id,
+                            node_id tail_id,
+                            std::size_t tree_size)
+    {
+        const auto* children = &get_node_children(get_entry(root_id));
+        while (!children->empty()) {
+            const auto id = children->back();
+            auto& entry   = get_entry(id);
+            if (entry.leaf_info) {
+                check_full(id);
+                break;
             }
+            children = &get_node_children(entry);
+        }
+
+        using immer::detail::rbts::mask;
+        const auto tail_offset   = tree_size ? (tree_size - 1) & ~mask<BL> : 0;
+        const auto expected_size = tree_size - tail_offset;
+        const auto tail_size     = get_node_size(tail_id);
+        if (tail_size != expected_size) {
+            throw vector_corrupted_exception{tail_id, expected_size, tail_size};
+        }
+    }
+
+    node_t* make_inner(const std::vector<node_t*>& children,
+                       const std::vector<node_id>& children_ids,
+                       bool is_relaxed)
+    {
+        const auto n = children.size();
+        auto* inner =
+            is_relaxed ? node_t::make_inner_r_n(n) : node_t::make_inner_n(n);
+        if (is_relaxed) {
+            inner->relaxed()->d.count = n;
         }
 
-        inners_        = std::move(inners_).set(id, inner);
-        loaded_inners_ = std::move(loaded_inners_).set(inner.get(), id);
+        // Each child is referenced by the new node.
+        auto running_size = std::size_t{};
+        for (const auto& [index, child_node_id] :
+             boost::adaptors::index(children_ids)) {
+            children[index]->inc();
+            inner->inner()[index] = children[index];
+            if (is_relaxed) {
+                running_size += get_node_size(child_node_id);
+                inner->relaxed()->d.sizes[index] = running_size;
+            }
+        }
         return inner;
     }
 
-    node_ptr
-    load_some_node(node_id id, nodes_set_t loading_nodes, bool relaxed_allowed)
+    node_t* load_some_node(node_id id, bool relaxed_allowed)
     {
         // Unknown type: leaf, inner or relaxed
-        if (ar_.leaves.count(id)) {
-            return load_leaf(id);
+        const auto* entry = find_entry(id);
+        if (!entry) {
+            throw invalid_node_id{id};
         }
-        if (ar_.inners.count(id)) {
-            return load_inner(id, std::move(loading_nodes), relaxed_allowed);
+        if (entry->leaf_info) {
+            return load_leaf(id);
         }
-        throw invalid_node_id{id};
+        return load_inner(id, relaxed_allowed);
     }
 
-    immer::vector<node_id> get_node_children(const inner_node& node_info)
+    const std::vector<node_id>& get_node_children(node_entry& entry)
     {
-        // Ignore empty children
-        auto result = immer::vector<node_id>{};
-        for (const auto& child_node_id : node_info.children) {
-            const auto child_size = get_node_size(child_node_id);
-            if (child_size) {
-                result = std::move(result).push_back(child_node_id);
+        if (!entry.children) {
+            // Ignore empty children
+            auto result = std::vector<node_id>{};
+            result.reserve(entry.inner_info->children.size());
+            for (const auto& child_node_id : entry.inner_info->children) {
+                const auto child_size = get_node_size(child_node_id);
+                if (child_size) {
+                    result.push_back(child_node_id);
+                }
             }
+            entry.children = std::move(result);
         }
-        return result;
+        return *entry.children;
     }
 
-    std::size_t get_node_size(node_id id, nodes_set_t loading_nodes = {})
+    std::size_t get_node_size(node_id id)
     {
-        if (auto* p = sizes_.find(id)) {
-            return *p;
+        auto* entry = find_entry(id);
+        if (!entry) {
+            throw invalid_node_id{id};
+        }
+        if (entry->size) {
+            return *entry->size;
         }
         auto size = [&] {
-            if (auto* p = ar_.leaves.find(id)) {
-                return p->data.size();
+            if (entry->leaf_info) {
+                return entry->leaf_info->size();
             }
-            if (auto* p = ar_.inners.find(id)) {
-                auto result   = std::size_t{};
-                loading_nodes = std::move(loading_nodes).insert(id);
-                for (const auto& child_id : p->children) {
-                    if (loading_nodes.count(child_id)) {
-                        throw archive_has_cycles{child_id};
-                    }
-                    result += get_node_size(child_id, loading_nodes);
+            const auto grey = grey_guard{entry->sizing};
+            auto result     = std::size_t{};
+            for (const auto& child_id : entry->inner_info->children) {
+                const auto* child = find_entry(child_id);
+                if (child && child->sizing) {
+                    throw archive_has_cycles{child_id};
                 }
-                return result;
+                result += get_node_size(child_id);
             }
-            throw invalid_node_id{id};
+            return result;
         }();
-        sizes_ = std::move(sizes_).set(id, size);
+        entry->size = size;
         return size;
     }
 
     immer::detail::rbts::count_t get_node_depth(node_id id)
     {
-        if (auto* p = depths_.find(id)) {
-            return *p;
+        auto* entry = find_entry(id);
+        if (!entry) {
+            throw invalid_node_id{id};
+        }
+        if (entry->depth) {
+            return *entry->depth;
         }
         auto depth = [&]() -> immer::detail::rbts::count_t {
-            if (auto* p = ar_.leaves.find(id)) {
+            if (entry->leaf_info) {
                 return 0;
             }
-            if (auto* p = ar_.inners.find(id)) {
-                if (p->children.empty()) {
-                    return 1;
-                } else {
-                    return 1 + get_node_depth(p->children.front());
-                }
+            const auto* p = entry->inner_info;
+            if (p->children.empty()) {
+                return 1;
+            } else {
+                return 1 + get_node_depth(p->children.front());
             }
-            throw invalid_node_id{id};
         }();
-        depths_ = std::move(depths_).set(id, depth);
+        entry->depth = depth;
         return depth;
     }
 
-    std::vector<node_ptr>
+    std::vector<node_t*>
     load_children(node_id id,
-                  const immer::vector<node_id>& children_ids,
-                  const nodes_set_t& loading_nodes,
+                  const std::vector<node_id>& children_ids,
                   bool relaxed_allowed)
     {
         auto children_depth = immer::detail::rbts::count_t{};
-        auto result         = std::vector<node_ptr>{};
+        auto result         = std::vector<node_t*>{};
         for (const auto& child_node_id : children_ids) {
             // Better to load the node first and then check the depth, because
             // loading has extra protections against loops.
-            auto child =
-                load_some_node(child_node_id, loading_nodes, relaxed_allowed);
+            auto child = load_some_node(child_node_id, relaxed_allowed);
 
             const auto depth = get_node_depth(child_node_id);
             if (result.empty()) {
@@ -371,28 +717,48 @@ private:
                     id, children_depth, child_node_id, depth};
             }
 
-            result.emplace_back(std::move(child));
+            result.push_back(child);
         }
         return result;
     }
 
     template <class Tree>
-    void verify_tree(const Tree& impl)
+    void verify(const Tree& impl)
+    {
+        switch (verifier_.next()) {
+        case immer_archive::detail::verify_depth::full:
+            verify_tree(impl, true);
+            break;
+        case immer_archive::detail::verify_depth::structure:
+            verify_tree(impl, false);
+            break;
+        case immer_archive::detail::verify_depth::none:
+            break;
+        }
+    }
+
+    /**
+     * Check the loaded tree against the archive. Without recursing, only the
+     * root and the tail are checked.
+     */
+    template <class Tree>
+    void verify_tree(const Tree& impl, bool recursive)
     {
         const auto check_inner = [&](auto&& pos,
                                      auto&& visit,
                                      bool visiting_relaxed) {
-            const auto* id = loaded_inners_.find(pos.node());
-            if (!id) {
-                if (loaded_leaves_.find(pos.node())) {
-                    throw std::logic_error{"A node is expected to be an inner "
-                                           "node but it's actually a leaf"};
-                }
-
+            const auto it = node_ids_.find(pos.node());
+            if (it == node_ids_.end()) {
                 throw std::logic_error{"Inner node of a freshly loaded "
                                        "vector is unknown"};
             }
-            const auto* info = ar_.inners.find(*id);
+            const auto id = it->second;
+            auto& entry   = get_entry(id);
+            if (entry.inner != pos.node()) {
+                throw std::logic_error{"A node is expected to be an inner "
+                                       "node but it's actually a leaf"};
+            }
+            const auto* info = entry.inner_info;
             assert(info);
             if (!info) {
                 throw std::logic_error{
@@ -411,12 +777,15 @@ private:
             // }
 
             const auto expected_count = pos.count();
-            const auto real_count     = get_node_children(*info).size();
+            const auto real_count     = get_node_children(entry).size();
             if (expected_count != real_count) {
                 throw vector_corrupted_exception{
-                    *id, expected_count, real_count};
+                    id, expected_count, real_count};
             }
 
+            if (!recursive) {
+                return;
+            }
             pos.each(detail::visitor_helper{},
                      [&visit](auto any_tag, auto& child_pos, auto&&) {
                          visit(child_pos);
@@ -438,13 +807,15 @@ private:
                 },
                 [&](detail::leaf_pos_tag, auto&& pos, auto&& visit) {
                     // SPDLOG_INFO("leaf_pos_tag");
-                    const auto* id = loaded_leaves_.find(pos.node());
-                    assert(id);
-                    if (!id) {
+                    const auto it = node_ids_.find(pos.node());
+                    assert(it != node_ids_.end());
+                    if (it == node_ids_.end() ||
+                        get_entry(it->second).leaf != pos.node()) {
                         throw std::logic_error{
                             "Leaf of a freshly loaded vector is unknown"};
                     }
-                    const auto* info = ar_.leaves.find(*id);
+                    const auto id    = it->second;
+                    const auto& info = get_entry(id).leaf_info;
                     assert(info);
                     if (!info) {
                         throw std::logic_error{
@@ -452,22 +823,32 @@ private:
                     }
 
                     const auto expected_count = pos.count();
-                    const auto real_count     = info->data.size();
+                    const auto real_count     = info->size();
                     if (expected_count != real_count) {
                         throw vector_corrupted_exception{
-                            *id, expected_count, real_count};
+                            id, expected_count, real_count};
                     }
                 }));
     }
 
 private:
+    void add_inner_entries()
+    {
+        for (const auto& [id, info] : ar_.inners) {
+            get_entry(id).inner_info = &info;
+        }
+    }
+
+    // The entries point into the archive, which is never modified.
     const archive_load<T> ar_;
-    immer::map<node_id, node_ptr> leaves_;
-    immer::map<node_id, node_ptr> inners_;
-    immer::map<node_t*, node_id> loaded_leaves_;
-    immer::map<node_t*, node_id> loaded_inners_;
-    immer::map<node_id, std::size_t> sizes_;
-    immer::map<node_id, immer::detail::rbts::count_t> depths_;
+    // Keeps the saved vectors alive when loading from an archive_save, its
+    // leaves are read directly.
+    std::shared_ptr<const void> saved_;
+    std::vector<node_entry> entries_;
+    std::unordered_map<std::size_t, node_entry> sparse_entries_;
+    std::unordered_map<const node_t*, node_id> node_ids_;
+    immer_archive::detail::verifier verifier_;
+    std::shared_ptr<pool_t> pool_;
 };
 
 template <typename T,
@@ -477,13 +858,44 @@ template <typename T,
 class vector_loader
 {
 public:
-    explicit vector_loader(archive_load<T> ar)
-        : loader{std::move(ar)}
+    using pool_t = node_pool_base<T, MemoryPolicy, B, BL>;
+
+    explicit vector_loader(archive_load<T> ar,
+                           verify_policy verify         = {},
+                           std::shared_ptr<pool_t> pool = {})
+        : loader{std::move(ar), verify, std::move(pool)}
+    {
+    }
+
+    template <typename SourceMemoryPolicy>
+    explicit vector_loader(archive_save<T, SourceMemoryPolicy, B, BL> ar,
+                           verify_policy verify         = {},
+                           std::shared_ptr<pool_t> pool = {})
+        : loader{std::move(ar), verify, std::move(pool)}
     {
     }
 
     auto load(container_id id) { return loader.load_vector(id); }
 
+    std::size_t containers_count() const { return loader.containers_count(); }
+
+    /**
+     * Load all the containers of the archive, creating their leaves on the
+     * given number of threads. Nodes are shared between the containers as
+     * usual, and later calls to load() reuse them. Containers that fail to
+     * load are skipped, loading them with load() reports why.
+     */
+    void preload(std::size_t threads = default_thread_count())
+    {
+        loader.preload_leaves(threads);
+        for (auto id = std::size_t{}; id < loader.containers_count(); ++id) {
+            try {
+                loader.load_vector(container_id{id});
+            } catch (const archive_exception&) {
+            }
+        }
+    }
+
 private:
     loader<T, MemoryPolicy, B, BL> loader;
 };
@@ -494,9 +906,27 @@ template <typename T,
           immer::detail::rbts::bits_t BL>
 vector_loader<T, MemoryPolicy, B, BL>
 make_loader_for(const immer::vector<T, MemoryPolicy, B, BL>&,
-                archive_load<T> ar)
+                archive_load<T> ar,
+                verify_policy verify                       = {},
+                node_pool_ptr<T, MemoryPolicy, B, BL> pool = {})
 {
-    return vector_loader<T, MemoryPolicy, B, BL>{std::move(ar)};
+    return vector_loader<T, MemoryPolicy, B, BL>{
+        std::move(ar), verify, std::move(pool)};
+}
+
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL,
+          typename SourceMemoryPolicy>
+vector_loader<T, MemoryPolicy, B, BL>
+make_loader_for(const immer::vector<T, MemoryPolicy, B, BL>&,
+                archive_save<T, SourceMemoryPolicy, B, BL> ar,
+                verify_policy verify                       = {},
+                node_pool_ptr<T, MemoryPolicy, B, BL> pool = {})
+{
+    return vector_loader<T, MemoryPolicy, B, BL>{
+        std::move(ar), verify, std::move(pool)};
 }
 
 template <typename T,
@@ -506,13 +936,44 @@ template <typename T,
 class flex_vector_loader
 {
 public:
-    explicit flex_vector_loader(archive_load<T> ar)
-        : loader{std::move(ar)}
+    using pool_t = node_pool_base<T, MemoryPolicy, B, BL>;
+
+    explicit flex_vector_loader(archive_load<T> ar,
+                                verify_policy verify         = {},
+                                std::shared_ptr<pool_t> pool = {})
+        : loader{std::move(ar), verify, std::move(pool)}
+    {
+    }
+
+    template <typename SourceMemoryPolicy>
+    explicit flex_vector_loader(archive_save<T, SourceMemoryPolicy, B, BL> ar,
+                                verify_policy verify         = {},
+                                std::shared_ptr<pool_t> pool = {})
+        : loader{std::move(ar), verify, std::move(pool)}
     {
     }
 
     auto load(container_id id) { return loader.load_flex_vector(id); }
 
+    std::size_t containers_count() const { return loader.containers_count(); }
+
+    /**
+     * Load all the containers of the archive, creating their leaves on the
+     * given number of threads. Nodes are shared between the containers as
+     * usual, and later calls to load() reuse them. Containers that fail to
+     * load are skipped, loading them with load() reports why.
+     */
+    void preload(std::size_t threads = default_thread_count())
+    {
+        loader.preload_leaves(threads);
+        for (auto id = std::size_t{}; id < loader.containers_count(); ++id) {
+            try {
+                loader.load_flex_vector(container_id{id});
+            } catch (const archive_exception&) {
+            }
+        }
+    }
+
 private:
     loader<T, MemoryPolicy, B, BL> loader;
 };
@@ -523,9 +984,50 @@ template <typename T,
           immer::detail::rbts::bits_t BL>
 flex_vector_loader<T, MemoryPolicy, B, BL>
 make_loader_for(const immer::flex_vector<T, MemoryPolicy, B, BL>&,
-                archive_load<T> ar)
+                archive_load<T> ar,
+                verify_policy verify                       = {},
+                node_pool_ptr<T, MemoryPolicy, B, BL> pool = {})
+{
+    return flex_vector_loader<T, MemoryPolicy, B, BL>{
+        std::move(ar), verify, std::move(pool)};
+}
+
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL,
+          typename SourceMemoryPolicy>
+flex_vector_loader<T, MemoryPolicy, B, BL>
+make_loader_for(const immer::flex_vector<T, MemoryPolicy, B, BL>&,
+                archive_save<T, SourceMemoryPolicy, B, BL> ar,
+                verify_policy verify                       = {},
+                node_pool_ptr<T, MemoryPolicy, B, BL> pool = {})
 {
-    return flex_vector_loader<T, MemoryPolicy, B, BL>{std::move(ar)};
+    return flex_vector_loader<T, MemoryPolicy, B, BL>{
+        std::move(ar), verify, std::move(pool)};
+}
+
+/**
+ * Rebuild all the vectors of an in-memory archive on new nodes, without
+ * serializing it. Container is the type of the new vectors and may use another
+ * memory policy than the saved ones. Nodes shared in the archive stay shared
+ * between the new vectors. The result is indexed by container ID.
+ */
+template <class Container,
+          typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+immer::vector<Container>
+rebuild_containers(archive_save<T, MemoryPolicy, B, BL> ar,
+                   verify_policy verify = {})
+{
+    auto loader = make_loader_for(Container{}, std::move(ar), verify);
+    auto result = immer::vector<Container>{}.transient();
+    for (auto id = std::size_t{}; id < loader.containers_count(); ++id) {
+        result.push_back(loader.load(container_id{id}));
+    }
+    return std::move(result).persistent();
 }
 
 } // namespace immer_archive::rbts
@@ -0,0 +1,272 @@
+#pragma once
+
+#include <immer-archive/common/archive.hpp>
+#include <immer-archive/xxhash/xxhash.hpp>
+
+#include <immer/detail/rbts/node.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace immer_archive::rbts {
+
+/**
+ * What the loader needs from a node pool, so that loaders don't depend on how
+ * the values are hashed.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+class node_pool_base
+{
+public:
+    using node_t = immer::detail::rbts::node<T, MemoryPolicy, B, BL>;
+
+    virtual ~node_pool_base() = default;
+
+    /**
+     * Return a leaf with the given values, or nullptr. The leaf is borrowed
+     * from the pool.
+     */
+    virtual node_t* find_leaf(const values_save<T>& values) const = 0;
+
+    /**
+     * Return an inner node with the given children, or nullptr. The node is
+     * borrowed from the pool.
+     */
+    virtual node_t* find_inner(const std::vector<node_t*>& children,
+                               bool relaxed) const = 0;
+
+    /**
+     * Add a new node to the pool, which takes its own reference to it.
+     */
+    virtual void add_leaf(node_t* leaf, std::size_t n)                 = 0;
+    virtual void add_inner(node_t* inner, std::size_t n, bool relaxed) = 0;
+};
+
+/**
+ * The pool argument of the loader factories. Any pool converts to it, the
+ * types of the nodes are deduced from the container.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+using node_pool_ptr = std::shared_ptr<
+    std::type_identity_t<node_pool_base<T, MemoryPolicy, B, BL>>>;
+
+/**
+ * Nodes shared by the loaders that are given the same pool, found by their
+ * contents. A leaf is reused when its values are equal, and an inner node when
+ * it has the same children, which are themselves reused nodes. Restoring an
+ * archive again, or another archive with some of the same contents, then gives
+ * back the nodes that are already in memory.
+ *
+ * The pool keeps a reference to all its nodes, so they are never modified in
+ * place by the containers that use them, and they stay in memory until they
+ * are trimmed. It's not thread-safe.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL,
+          class Hash = xx_hash<T>>
+class node_pool final : public node_pool_base<T, MemoryPolicy, B, BL>
+{
+public:
+    using node_t = immer::detail::rbts::node<T, MemoryPolicy, B, BL>;
+
+    node_pool() = default;
+
+    node_pool(const node_pool&)            = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool() override
+    {
+        for (const auto& [node, info] : nodes_) {
+            release(node);
+        }
+    }
+
+    std::size_t size() const { return nodes_.size(); }
+
+    /**
+     * Free the nodes that nothing but the pool uses anymore, and return how
+     * many there were. Nodes used by a container, by a loader or by another
+     * node that is kept are kept. Call it once the containers restored from
+     * an old archive are gone, for example after replacing them by the ones
+     * of a newer archive, otherwise the pool only grows.
+     */
+    std::size_t trim()
+    {
+        auto unused = std::vector<node_t*>{};
+        for (const auto& [node, info] : nodes_) {
+            if (node_t::refs(node).unique()) {
+                unused.push_back(node);
+            }
+        }
+
+        auto trimmed = std::size_t{};
+        while (!unused.empty()) {
+            auto* node = unused.back();
+            unused.pop_back();
+
+            const auto info = nodes_.at(node);
+            forget(node, info.hash);
+            ++trimmed;
+            if (info.leaf) {
+                node_t::delete_leaf(node, info.n);
+                continue;
+            }
+            // The children are in the pool too, they may only be used by it
+            // now.
+            for (auto i = std::size_t{}; i < info.n; ++i) {
+                auto* child = node->inner()[i];
+                child->dec();
+                if (node_t::refs(child).unique()) {
+                    unused.push_back(child);
+                }
+            }
+            if (info.relaxed) {
+                node_t::delete_inner_r(node, info.n);
+            } else {
+                node_t::delete_inner(node, info.n);
+            }
+        }
+        return trimmed;
+    }
+
+    node_t* find_leaf(const values_save<T>& values) const override
+    {
+        const auto it = by_hash_.find(hash_leaf(values));
+        if (it == by_hash_.end()) {
+            return nullptr;
+        }
+        for (auto* node : it->second) {
+            const auto& info = nodes_.at(node);
+            if (info.leaf && info.n == values.size() &&
+                std::equal(values.begin, values.end, node->leaf())) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    node_t* find_inner(const std::vector<node_t*>& children,
+                       bool relaxed) const override
+    {
+        const auto it = by_hash_.find(hash_inner(children, relaxed));
+        if (it == by_hash_.end()) {
+            return nullptr;
+        }
+        for (auto* node : it->second) {
+            const auto& info = nodes_.at(node);
+            if (!info.leaf && info.relaxed == relaxed &&
+                info.n == children.size() &&
+                std::equal(children.begin(), children.end(), node->inner())) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    void add_leaf(node_t* leaf, std::size_t n) override
+    {
+        add(leaf,
+            {
+                .n    = n,
+                .hash = hash_leaf({.begin = leaf->leaf(),
+                                   .end   = leaf->leaf() + n}),
+                .leaf = true,
+            });
+    }
+
+    void add_inner(node_t* inner, std::size_t n, bool relaxed) override
+    {
+        const auto children =
+            std::vector<node_t*>{inner->inner(), inner->inner() + n};
+        add(inner,
+            {
+                .n       = n,
+                .hash    = hash_inner(children, relaxed),
+                .relaxed = relaxed,
+            });
+    }
+
+private:
+    struct node_info
+    {
+        std::size_t n    = 0;
+        std::size_t hash = 0;
+        bool leaf        = false;
+        bool relaxed     = false;
+    };
+
+    void add(node_t* node, node_info info)
+    {
+        node->inc();
+        nodes_.emplace(node, info);
+        by_hash_[info.hash].push_back(node);
+    }
+
+    void forget(node_t* node, std::size_t hash)
+    {
+        nodes_.erase(node);
+        auto& nodes = by_hash_.at(hash);
+        nodes.erase(std::find(nodes.begin(), nodes.end(), node));
+        if (nodes.empty()) {
+            by_hash_.erase(hash);
+        }
+    }
+
+    /**
+     * The children of an inner node in the pool are in the pool too.
+     */
+    void release(node_t* node)
+    {
+        if (!node->dec()) {
+            return;
+        }
+
+        const auto& info = nodes_.at(node);
+        if (info.leaf) {
+            node_t::delete_leaf(node, info.n);
+            return;
+        }
+        for (auto i = std::size_t{}; i < info.n; ++i) {
+            release(node->inner()[i]);
+        }
+        if (info.relaxed) {
+            node_t::delete_inner_r(node, info.n);
+        } else {
+            node_t::delete_inner(node, info.n);
+        }
+    }
+
+    static std::size_t hash_leaf(const values_save<T>& values)
+    {
+        return xx_hash_range<T, Hash>(values.begin, values.end);
+    }
+
+    static std::size_t hash_inner(const std::vector<node_t*>& children,
+                                  bool relaxed)
+    {
+        auto keys = std::vector<std::uintptr_t>{};
+        keys.reserve(children.size() + 1);
+        keys.push_back(relaxed ? 1 : 0);
+        for (const auto* child : children) {
+            keys.push_back(reinterpret_cast<std::uintptr_t>(child));
+        }
+        return xx_hash_bytes(keys.data(), keys.size() * sizeof(std::uintptr_t));
+    }
+
+    std::unordered_map<node_t*, node_info> nodes_;
+    std::unordered_map<std::size_t, std::vector<node_t*>> by_hash_;
+};
+
+} // namespace immer_archive::rbts
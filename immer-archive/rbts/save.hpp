@@ -1,45 +1,62 @@
 #pragma once
 
+#include <immer-archive/common/concurrent_node_table.hpp>
+#include <immer-archive/common/parallel.hpp>
 #include <immer-archive/rbts/traverse.hpp>
+#include <immer-archive/xxhash/xxhash.hpp>
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
 namespace immer_archive::rbts {
 
 namespace detail {
 
+/**
+ * Collects the nodes of a tree into the archive. The maps of the archive are
+ * edited through transients while traversing, so that visiting a node does not
+ * copy a path of the persistent maps, and turned back into persistent maps by
+ * finish().
+ */
 template <typename T,
           typename MemoryPolicy,
           immer::detail::rbts::bits_t B,
           immer::detail::rbts::bits_t BL>
-std::pair<archive_save<T, MemoryPolicy, B, BL>, node_id>
-get_node_id(archive_save<T, MemoryPolicy, B, BL> ar,
-            const immer::detail::rbts::node<T, MemoryPolicy, B, BL>* ptr)
+struct archive_builder
 {
-    auto* ptr_void = static_cast<const void*>(ptr);
-    if (auto* maybe_id = ar.node_ptr_to_id.find(ptr_void)) {
-        auto id = *maybe_id;
-        return {std::move(ar), id};
+    using archive_t = archive_save<T, MemoryPolicy, B, BL>;
+
+    archive_t ar;
+    typename decltype(archive_t::leaves)::transient_type leaves;
+    typename decltype(archive_t::inners)::transient_type inners;
+    typename decltype(archive_t::node_ptr_to_id)::transient_type node_ptr_to_id;
+
+    explicit archive_builder(archive_t ar_)
+        : ar{std::move(ar_)}
+        , leaves{std::move(ar.leaves).transient()}
+        , inners{std::move(ar.inners).transient()}
+        , node_ptr_to_id{std::move(ar.node_ptr_to_id).transient()}
+    {
     }
 
-    const auto id     = node_id{ar.node_ptr_to_id.size()};
-    ar.node_ptr_to_id = std::move(ar.node_ptr_to_id).set(ptr_void, id);
-    return {std::move(ar), id};
-}
-
-template <typename T,
-          typename MemoryPolicy,
-          immer::detail::rbts::bits_t B,
-          immer::detail::rbts::bits_t BL>
-struct archive_builder
-{
-    archive_save<T, MemoryPolicy, B, BL> ar;
+    archive_t finish() &&
+    {
+        ar.leaves         = std::move(leaves).persistent();
+        ar.inners         = std::move(inners).persistent();
+        ar.node_ptr_to_id = std::move(node_ptr_to_id).persistent();
+        return std::move(ar);
+    }
 
     template <class Pos>
     void operator()(regular_pos_tag, Pos& pos, auto&& visit)
     {
         auto id = get_node_id(pos.node());
-        if (ar.inners.count(id)) {
+        if (inners.count(id)) {
             return;
         }
 
@@ -53,14 +70,14 @@ struct archive_builder
                              .push_back(this->get_node_id(child_pos.node()));
                      visit(child_pos);
                  });
-        ar.inners = std::move(ar.inners).set(id, node_info);
+        inners.set(id, std::move(node_info));
     }
 
     template <class Pos>
     void operator()(relaxed_pos_tag, Pos& pos, auto&& visit)
     {
         auto id = get_node_id(pos.node());
-        if (ar.inners.count(id)) {
+        if (inners.count(id)) {
             return;
         }
 
@@ -81,7 +98,7 @@ struct archive_builder
 
         assert(node_info.children.size() == pos.node()->relaxed()->d.count);
 
-        ar.inners = std::move(ar.inners).set(id, node_info);
+        inners.set(id, std::move(node_info));
     }
 
     template <class Pos>
@@ -89,7 +106,7 @@ struct archive_builder
     {
         T* first = pos.node()->leaf();
         auto id  = get_node_id(pos.node());
-        if (ar.leaves.count(id)) {
+        if (leaves.count(id)) {
             // SPDLOG_DEBUG("already seen leaf node {}", id);
             return;
         }
@@ -100,47 +117,299 @@ struct archive_builder
             .begin = first,
             .end   = first + pos.count(),
         };
-        ar.leaves = std::move(ar.leaves).set(id, std::move(info));
+        leaves.set(id, std::move(info));
     }
 
-    node_id get_node_id(immer::detail::rbts::node<T, MemoryPolicy, B, BL>* ptr)
+    node_id
+    get_node_id(const immer::detail::rbts::node<T, MemoryPolicy, B, BL>* ptr)
     {
-        auto [ar2, id] =
-            immer_archive::rbts::detail::get_node_id(std::move(ar), ptr);
-        ar = std::move(ar2);
+        auto* ptr_void = static_cast<const void*>(ptr);
+        if (auto* maybe_id = node_ptr_to_id.find(ptr_void)) {
+            return *maybe_id;
+        }
+
+        const auto id = node_id{node_ptr_to_id.size()};
+        node_ptr_to_id.set(ptr_void, id);
         return id;
     }
 };
 
+/**
+ * Collects the nodes of a tree into the archive like archive_builder, but gives
+ * the same ID to the nodes that have the same contents. A node gets its ID once
+ * its children have theirs, so IDs are given in post-order.
+ */
 template <typename T,
           typename MemoryPolicy,
           immer::detail::rbts::bits_t B,
           immer::detail::rbts::bits_t BL,
-          class Archive>
-auto save_nodes(const immer::detail::rbts::rbtree<T, MemoryPolicy, B, BL>& tree,
-                Archive ar)
+          class Hash>
+struct content_archive_builder
 {
-    auto save = archive_builder<T, MemoryPolicy, B, BL>{
-        .ar = std::move(ar),
-    };
-    tree.traverse(visitor_helper{}, save);
-    return std::move(save.ar);
-}
+    using archive_t = archive_save<T, MemoryPolicy, B, BL>;
+    using node_t    = immer::detail::rbts::node<T, MemoryPolicy, B, BL>;
+
+    archive_builder<T, MemoryPolicy, B, BL> save;
+    // The nodes that got a new ID while traversing, by the hash of their
+    // contents. They're added to the persistent map of the archive once, by
+    // finish().
+    std::unordered_map<std::size_t, std::vector<node_id>> new_content_to_ids;
+    typename decltype(archive_t::merged_node_ptr_to_id)::transient_type
+        merged_node_ptr_to_id;
+
+    // The ID of the node visited last, read by its parent.
+    node_id last_id;
+
+    explicit content_archive_builder(archive_t ar_)
+        : save{std::move(ar_)}
+        , merged_node_ptr_to_id{
+              std::move(save.ar.merged_node_ptr_to_id).transient()}
+    {
+    }
+
+    archive_t finish() &&
+    {
+        auto content_to_ids = std::move(save.ar.content_to_ids).transient();
+        for (const auto& [hash, ids] : new_content_to_ids) {
+            const auto* saved = content_to_ids.find(hash);
+            auto all =
+                (saved ? *saved : immer::vector<node_id>{}).transient();
+            for (const auto& id : ids) {
+                all.push_back(id);
+            }
+            content_to_ids.set(hash, std::move(all).persistent());
+        }
+        save.ar.content_to_ids = std::move(content_to_ids).persistent();
+        save.ar.merged_node_ptr_to_id =
+            std::move(merged_node_ptr_to_id).persistent();
+        return std::move(save).finish();
+    }
+
+    const node_id* find_node_id(const node_t* ptr) const
+    {
+        if (const auto* id = save.node_ptr_to_id.find(ptr)) {
+            return id;
+        }
+        return merged_node_ptr_to_id.find(ptr);
+    }
+
+    template <class Pos>
+    void operator()(regular_pos_tag, Pos& pos, auto&& visit)
+    {
+        visit_inner(pos, visit, false);
+    }
+
+    template <class Pos>
+    void operator()(relaxed_pos_tag, Pos& pos, auto&& visit)
+    {
+        visit_inner(pos, visit, true);
+    }
+
+    template <class Pos>
+    void operator()(leaf_pos_tag, Pos& pos, auto&& visit)
+    {
+        if (const auto* id = find_node_id(pos.node())) {
+            last_id = *id;
+            return;
+        }
+
+        const T* first  = pos.node()->leaf();
+        const auto info = values_save<T>{
+            .begin = first,
+            .end   = first + pos.count(),
+        };
+        last_id = add_node(
+            pos.node(),
+            xx_hash_range<T, Hash>(info.begin, info.end),
+            [&](node_id id) {
+                const auto* leaf = save.leaves.find(id);
+                return leaf &&
+                       std::equal(leaf->begin, leaf->end, info.begin, info.end);
+            },
+            [&](node_id id) { save.leaves.set(id, info); });
+    }
+
+    template <class Pos>
+    void visit_inner(Pos& pos, auto&& visit, bool relaxed)
+    {
+        if (const auto* id = find_node_id(pos.node())) {
+            last_id = *id;
+            return;
+        }
+
+        auto node_info = inner_node{
+            .relaxed = relaxed,
+        };
+        pos.each(visitor_helper{},
+                 [&](auto any_tag, auto& child_pos, auto&&) mutable {
+                     visit(child_pos);
+                     node_info.children =
+                         std::move(node_info.children).push_back(last_id);
+                 });
+        last_id = add_node(
+            pos.node(),
+            hash_inner(node_info),
+            [&](node_id id) {
+                const auto* inner = save.inners.find(id);
+                return inner && *inner == node_info;
+            },
+            [&](node_id id) { save.inners.set(id, node_info); });
+    }
+
+    /**
+     * Give the node the ID of a saved node with the same contents, or a new ID
+     * when there's none.
+     */
+    node_id add_node(const node_t* ptr,
+                     std::size_t hash,
+                     auto&& same_contents,
+                     auto&& set_node)
+    {
+        const auto find_same = [&](const auto& candidates) -> const node_id* {
+            const auto it = std::find_if(
+                candidates.begin(), candidates.end(), same_contents);
+            return it == candidates.end() ? nullptr : &*it;
+        };
+
+        const auto* saved = save.ar.content_to_ids.find(hash);
+        if (const auto* same = saved ? find_same(*saved) : nullptr) {
+            merged_node_ptr_to_id.set(ptr, *same);
+            return *same;
+        }
+        auto& ids = new_content_to_ids[hash];
+        if (const auto* same = find_same(ids)) {
+            merged_node_ptr_to_id.set(ptr, *same);
+            return *same;
+        }
+
+        const auto id = save.get_node_id(ptr);
+        set_node(id);
+        ids.push_back(id);
+        return id;
+    }
+
+    static std::size_t hash_inner(const inner_node& node)
+    {
+        // An inner node of a tree has at most branches<B> children.
+        auto ids = std::array<std::size_t,
+                              immer::detail::rbts::branches<B> + 1>{};
+        auto n   = std::size_t{};
+        ids[n++] = node.relaxed ? 1 : 0;
+        for (const auto& child : node.children) {
+            ids[n++] = child.value;
+        }
+        return xx_hash_bytes(ids.data(), n * sizeof(std::size_t));
+    }
+};
+
+/**
+ * What archive_builder needs to know about a node, collected while traversing
+ * the trees in parallel.
+ */
+template <class T, class Node>
+struct node_record
+{
+    bool leaf    = false;
+    bool relaxed = false;
+    values_save<T> values;
+    std::vector<const Node*> children;
+};
 
+/**
+ * Records the nodes of a tree that are not in the archive yet, on behalf of
+ * the container with the given index. Nodes already claimed by a container
+ * with a lower index are skipped together with their children.
+ */
 template <typename T,
           typename MemoryPolicy,
           immer::detail::rbts::bits_t B,
-          immer::detail::rbts::bits_t BL,
-          class Archive>
-auto save_nodes(
-    const immer::detail::rbts::rrbtree<T, MemoryPolicy, B, BL>& tree,
-    Archive ar)
+          immer::detail::rbts::bits_t BL>
+struct nodes_collector
+{
+    using node_t   = immer::detail::rbts::node<T, MemoryPolicy, B, BL>;
+    using record_t = node_record<T, node_t>;
+
+    const archive_save<T, MemoryPolicy, B, BL>& ar;
+    concurrent_node_table<record_t>& records;
+    std::size_t owner;
+
+    template <class Pos>
+    void operator()(regular_pos_tag, Pos& pos, auto&& visit)
+    {
+        collect_inner(pos, visit, false);
+    }
+
+    template <class Pos>
+    void operator()(relaxed_pos_tag, Pos& pos, auto&& visit)
+    {
+        collect_inner(pos, visit, true);
+    }
+
+    template <class Pos>
+    void operator()(leaf_pos_tag, Pos& pos, auto&& visit)
+    {
+        if (auto* record = insert(pos.node())) {
+            const T* first = pos.node()->leaf();
+            record->leaf   = true;
+            record->values = {
+                .begin = first,
+                .end   = first + pos.count(),
+            };
+        }
+    }
+
+    template <class Pos>
+    void collect_inner(Pos& pos, auto&& visit, bool relaxed)
+    {
+        auto* record = insert(pos.node());
+        if (!record) {
+            return;
+        }
+
+        record->relaxed = relaxed;
+        pos.each(visitor_helper{},
+                 [&](auto any_tag, auto& child_pos, auto&&) mutable {
+                     record->children.push_back(child_pos.node());
+                     visit(child_pos);
+                 });
+    }
+
+    record_t* insert(const node_t* ptr)
+    {
+        if (ar.node_ptr_to_id.find(ptr)) {
+            return nullptr;
+        }
+        return records.insert(ptr, owner);
+    }
+};
+
+/**
+ * Add a recorded node and its children to the archive, visiting them in the
+ * same order as archive_builder does, so that they get the same IDs.
+ */
+template <class Builder, class Records, class Node>
+void save_recorded_node(Builder& save, const Records& records, const Node* ptr)
 {
-    auto save = archive_builder<T, MemoryPolicy, B, BL>{
-        .ar = std::move(ar),
+    const auto id = save.get_node_id(ptr);
+    if (save.inners.count(id) || save.leaves.count(id)) {
+        return;
+    }
+
+    const auto& record = records.at(ptr);
+    if (record.leaf) {
+        save.leaves.set(id, record.values);
+        return;
+    }
+
+    auto node_info = inner_node{
+        .relaxed = record.relaxed,
     };
-    tree.traverse(visitor_helper{}, save);
-    return std::move(save.ar);
+    for (const auto* child : record.children) {
+        node_info.children =
+            std::move(node_info.children).push_back(save.get_node_id(child));
+        save_recorded_node(save, records, child);
+    }
+    save.inners.set(id, std::move(node_info));
 }
 
 } // namespace detail
@@ -154,27 +423,25 @@ save_to_archive(immer::vector<T, MemoryPolicy, B, BL> vec,
                 archive_save<T, MemoryPolicy, B, BL> archive)
 {
     const auto& impl = vec.impl();
-    auto root_id     = node_id{};
-    auto tail_id     = node_id{};
-    std::tie(archive, root_id) =
-        detail::get_node_id(std::move(archive), impl.root);
-    std::tie(archive, tail_id) =
-        detail::get_node_id(std::move(archive), impl.tail);
+    auto save =
+        detail::archive_builder<T, MemoryPolicy, B, BL>{std::move(archive)};
     const auto tree_id = rbts_info{
-        .root = root_id,
-        .tail = tail_id,
+        .root = save.get_node_id(impl.root),
+        .tail = save.get_node_id(impl.tail),
     };
 
-    if (auto* p = archive.rbts_to_id.find(tree_id)) {
+    if (auto* p = save.ar.rbts_to_id.find(tree_id)) {
         // Already been saved
         auto vector_id = *p;
-        return {std::move(archive), vector_id};
+        return {std::move(save).finish(), vector_id};
     }
 
-    archive = detail::save_nodes(impl, std::move(archive));
+    impl.traverse(visitor_helper{}, save);
 
-    assert(archive.inners.count(root_id));
-    assert(archive.leaves.count(tail_id));
+    assert(save.inners.count(tree_id.root));
+    assert(save.leaves.count(tree_id.tail));
+
+    archive = std::move(save).finish();
 
     const auto vector_id = container_id{archive.vectors.size()};
 
@@ -195,27 +462,25 @@ save_to_archive(immer::flex_vector<T, MemoryPolicy, B, BL> vec,
                 archive_save<T, MemoryPolicy, B, BL> archive)
 {
     const auto& impl = vec.impl();
-    auto root_id     = node_id{};
-    auto tail_id     = node_id{};
-    std::tie(archive, root_id) =
-        detail::get_node_id(std::move(archive), impl.root);
-    std::tie(archive, tail_id) =
-        detail::get_node_id(std::move(archive), impl.tail);
+    auto save =
+        detail::archive_builder<T, MemoryPolicy, B, BL>{std::move(archive)};
     const auto tree_id = rbts_info{
-        .root = root_id,
-        .tail = tail_id,
+        .root = save.get_node_id(impl.root),
+        .tail = save.get_node_id(impl.tail),
     };
 
-    if (auto* p = archive.rbts_to_id.find(tree_id)) {
+    if (auto* p = save.ar.rbts_to_id.find(tree_id)) {
         // Already been saved
         auto vector_id = *p;
-        return {std::move(archive), vector_id};
+        return {std::move(save).finish(), vector_id};
     }
 
-    archive = detail::save_nodes(impl, std::move(archive));
+    impl.traverse(visitor_helper{}, save);
+
+    assert(save.inners.count(tree_id.root));
+    assert(save.leaves.count(tree_id.tail));
 
-    assert(archive.inners.count(root_id));
-    assert(archive.leaves.count(tail_id));
+    archive = std::move(save).finish();
 
     const auto vector_id = container_id{archive.vectors.size()};
 
@@ -227,4 +492,171 @@ save_to_archive(immer::flex_vector<T, MemoryPolicy, B, BL> vec,
     return {std::move(archive), vector_id};
 }
 
+namespace detail {
+
+template <class Hash,
+          class Container,
+          typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+std::pair<archive_save<T, MemoryPolicy, B, BL>, container_id>
+save_deduplicated(Container vec, archive_save<T, MemoryPolicy, B, BL> archive)
+{
+    const auto& impl         = vec.impl();
+    const auto merged_before = archive.merged_node_ptr_to_id.size();
+
+    auto save = content_archive_builder<T, MemoryPolicy, B, BL, Hash>{
+        std::move(archive)};
+    impl.traverse(visitor_helper{}, save);
+
+    const auto* root_id = save.find_node_id(impl.root);
+    const auto* tail_id = save.find_node_id(impl.tail);
+    assert(root_id && tail_id);
+    const auto tree_id = rbts_info{
+        .root = *root_id,
+        .tail = *tail_id,
+    };
+
+    archive = std::move(save).finish();
+
+    const auto* saved_id = archive.rbts_to_id.find(tree_id);
+    const auto vector_id =
+        saved_id ? *saved_id : container_id{archive.vectors.size()};
+
+    // The archive now knows nodes of the vector by their address, the vector
+    // is kept alive so that their memory isn't reused by other nodes. This is
+    // also the case when the vector has already been saved as another vector
+    // with the same contents, but its own nodes were merged into that one's.
+    if (!saved_id || archive.merged_node_ptr_to_id.size() != merged_before) {
+        if constexpr (std::is_same_v<Container,
+                                     immer::vector<T, MemoryPolicy, B, BL>>) {
+            archive.saved_vectors =
+                std::move(archive.saved_vectors).push_back(std::move(vec));
+        } else {
+            archive.saved_flex_vectors =
+                std::move(archive.saved_flex_vectors).push_back(std::move(vec));
+        }
+    }
+
+    if (!saved_id) {
+        archive.rbts_to_id =
+            std::move(archive.rbts_to_id).set(tree_id, vector_id);
+        archive.vectors = std::move(archive.vectors).push_back(tree_id);
+    }
+    return {std::move(archive), vector_id};
+}
+
+} // namespace detail
+
+/**
+ * Save the vector like save_to_archive does, and also give the same ID to the
+ * nodes with the same contents, even when they are different nodes. Vectors
+ * with equal contents that were built separately then share their nodes in the
+ * archive, and after loading. Leaves are compared by their values and inner
+ * nodes by the IDs of their children, they're found by an xxHash of their
+ * contents. Integers and other values without padding are hashed as bytes,
+ * a whole leaf at once, and other values with Hash, see xx_hash_range.
+ *
+ * Only the nodes saved with this function are candidates for being merged.
+ */
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL,
+          class Hash = xx_hash<T>>
+std::pair<archive_save<T, MemoryPolicy, B, BL>, container_id>
+save_to_archive_deduplicated(immer::vector<T, MemoryPolicy, B, BL> vec,
+                             archive_save<T, MemoryPolicy, B, BL> archive)
+{
+    return detail::save_deduplicated<Hash>(std::move(vec), std::move(archive));
+}
+
+template <typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL,
+          class Hash = xx_hash<T>>
+std::pair<archive_save<T, MemoryPolicy, B, BL>, container_id>
+save_to_archive_deduplicated(immer::flex_vector<T, MemoryPolicy, B, BL> vec,
+                             archive_save<T, MemoryPolicy, B, BL> archive)
+{
+    return detail::save_deduplicated<Hash>(std::move(vec), std::move(archive));
+}
+
+/**
+ * Save several vectors or flex vectors into the archive, traversing them on
+ * the given number of threads. Nodes shared between the containers are still
+ * saved once, and the result is the same as saving the containers one by one
+ * with save_to_archive, in order.
+ */
+template <class Container,
+          typename T,
+          typename MemoryPolicy,
+          immer::detail::rbts::bits_t B,
+          immer::detail::rbts::bits_t BL>
+std::pair<archive_save<T, MemoryPolicy, B, BL>, std::vector<container_id>>
+save_to_archive_parallel(const std::vector<Container>& containers,
+                         archive_save<T, MemoryPolicy, B, BL> archive,
+                         std::size_t threads = default_thread_count())
+{
+    using vector_t    = immer::vector<T, MemoryPolicy, B, BL>;
+    using collector_t = detail::nodes_collector<T, MemoryPolicy, B, BL>;
+    static_assert(
+        std::is_same_v<Container, vector_t> ||
+            std::is_same_v<Container,
+                           immer::flex_vector<T, MemoryPolicy, B, BL>>,
+        "Only vectors and flex vectors can be saved into an rbts archive");
+
+    // Traversing the trees is done in parallel, but IDs have to be assigned
+    // sequentially for the archive to be deterministic.
+    auto records =
+        detail::concurrent_node_table<typename collector_t::record_t>{};
+    detail::parallel_for(containers.size(), threads, [&](std::size_t index) {
+        auto collect = collector_t{
+            .ar      = archive,
+            .records = records,
+            .owner   = index,
+        };
+        containers[index].impl().traverse(detail::visitor_helper{}, collect);
+    });
+
+    auto save =
+        detail::archive_builder<T, MemoryPolicy, B, BL>{std::move(archive)};
+    auto ids = std::vector<container_id>{};
+    ids.reserve(containers.size());
+    for (const auto& container : containers) {
+        const auto& impl   = container.impl();
+        const auto tree_id = rbts_info{
+            .root = save.get_node_id(impl.root),
+            .tail = save.get_node_id(impl.tail),
+        };
+
+        if (auto* p = save.ar.rbts_to_id.find(tree_id)) {
+            // Already been saved
+            ids.push_back(*p);
+            continue;
+        }
+
+        detail::save_recorded_node(save, records, impl.root);
+        detail::save_recorded_node(save, records, impl.tail);
+
+        const auto vector_id = container_id{save.ar.vectors.size()};
+
+        save.ar.rbts_to_id =
+            std::move(save.ar.rbts_to_id).set(tree_id, vector_id);
+        save.ar.vectors = std::move(save.ar.vectors).push_back(tree_id);
+        if constexpr (std::is_same_v<Container, vector_t>) {
+            save.ar.saved_vectors =
+                std::move(save.ar.saved_vectors).push_back(container);
+        } else {
+            save.ar.saved_flex_vectors =
+                std::move(save.ar.saved_flex_vectors).push_back(container);
+        }
+        ids.push_back(vector_id);
+    }
+
+    return {std::move(save).finish(), std::move(ids)};
+}
+
 } // namespace immer_archive::rbts
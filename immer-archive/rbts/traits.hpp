@@ -1,6 +1,7 @@
 #pragma once
 
 #include <immer-archive/rbts/load.hpp>
+#include <immer-archive/rbts/node_pool.hpp>
 #include <immer-archive/rbts/save.hpp>
 #include <immer-archive/traits.hpp>
 
@@ -16,6 +17,7 @@ struct container_traits<immer::vector<T, MemoryPolicy, B, BL>>
     using load_archive_t = rbts::archive_load<T>;
     using loader_t       = rbts::vector_loader<T, MemoryPolicy, B, BL>;
     using container_id   = immer_archive::container_id;
+    using node_pool_t    = rbts::node_pool<T, MemoryPolicy, B, BL>;
 };
 
 template <typename T,
@@ -28,6 +30,7 @@ struct container_traits<immer::flex_vector<T, MemoryPolicy, B, BL>>
     using load_archive_t = rbts::archive_load<T>;
     using loader_t       = rbts::flex_vector_loader<T, MemoryPolicy, B, BL>;
     using container_id   = immer_archive::container_id;
+    using node_pool_t    = rbts::node_pool<T, MemoryPolicy, B, BL>;
 };
 
 } // namespace immer_archive
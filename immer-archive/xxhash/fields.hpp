@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace immer_archive::detail {
+
+/**
+ * Finds the types of the fields of simple structs, to tell whether they are
+ * made of integers only. A struct qualifies when it's a standard layout
+ * aggregate without C arrays, of at most max_fields fields that are integers,
+ * enums, std::arrays of them or such structs themselves. Anything else, like
+ * a pointer or a class with private members such as std::string_view, doesn't.
+ */
+inline constexpr auto max_fields = std::size_t{8};
+
+template <class... Ts>
+struct type_list
+{};
+
+template <class T>
+constexpr bool is_std_array_v = false;
+
+template <class T, std::size_t N>
+constexpr bool is_std_array_v<std::array<T, N>> = true;
+
+/**
+ * Converts to anything but the bases of T. Initializing T with as many of
+ * them as it has fields works, while a base class is split into its own
+ * fields, which tells it apart.
+ */
+template <class T>
+struct any_field
+{
+    template <class U>
+        requires(!std::is_base_of_v<U, T>)
+    operator U() const;
+};
+
+template <class T, bool Braced, std::size_t... I>
+constexpr bool is_initializable_with(std::index_sequence<I...>)
+{
+    if constexpr (Braced) {
+        return requires { T{{(void(I), any_field<T>{})}...}; };
+    } else {
+        return requires { T{(void(I), any_field<T>{})...}; };
+    }
+}
+
+/**
+ * The number of values that initialize T, or max_fields + 1 when there are
+ * more. Without braces, C arrays take one value per element and base classes
+ * one per field of the base. With braces, each of them takes one.
+ */
+template <class T, bool Braced, std::size_t N = 0>
+consteval std::size_t count_initializers()
+{
+    if constexpr (N > max_fields || !is_initializable_with<T, Braced>(
+                                        std::make_index_sequence<N + 1>{})) {
+        return N;
+    } else {
+        return count_initializers<T, Braced, N + 1>();
+    }
+}
+
+template <std::size_t N, class T>
+auto field_types(T& value)
+{
+    if constexpr (N == 1) {
+        [[maybe_unused]] auto& [a] = value;
+        return type_list<decltype(a)>{};
+    } else if constexpr (N == 2) {
+        [[maybe_unused]] auto& [a, b] = value;
+        return type_list<decltype(a), decltype(b)>{};
+    } else if constexpr (N == 3) {
+        [[maybe_unused]] auto& [a, b, c] = value;
+        return type_list<decltype(a), decltype(b), decltype(c)>{};
+    } else if constexpr (N == 4) {
+        [[maybe_unused]] auto& [a, b, c, d] = value;
+        return type_list<decltype(a), decltype(b), decltype(c), decltype(d)>{};
+    } else if constexpr (N == 5) {
+        [[maybe_unused]] auto& [a, b, c, d, e] = value;
+        return type_list<decltype(a),
+                         decltype(b),
+                         decltype(c),
+                         decltype(d),
+                         decltype(e)>{};
+    } else if constexpr (N == 6) {
+        [[maybe_unused]] auto& [a, b, c, d, e, f] = value;
+        return type_list<decltype(a),
+                         decltype(b),
+                         decltype(c),
+                         decltype(d),
+                         decltype(e),
+                         decltype(f)>{};
+    } else if constexpr (N == 7) {
+        [[maybe_unused]] auto& [a, b, c, d, e, f, g] = value;
+        return type_list<decltype(a),
+                         decltype(b),
+                         decltype(c),
+                         decltype(d),
+                         decltype(e),
+                         decltype(f),
+                         decltype(g)>{};
+    } else {
+        static_assert(N == max_fields);
+        [[maybe_unused]] auto& [a, b, c, d, e, f, g, h] = value;
+        return type_list<decltype(a),
+                         decltype(b),
+                         decltype(c),
+                         decltype(d),
+                         decltype(e),
+                         decltype(f),
+                         decltype(g),
+                         decltype(h)>{};
+    }
+}
+
+template <class T>
+consteval bool is_struct_of_integers();
+
+template <class T>
+consteval bool is_field_of_integers()
+{
+    if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+        return true;
+    } else if constexpr (is_std_array_v<T>) {
+        return is_field_of_integers<typename T::value_type>();
+    } else {
+        return is_struct_of_integers<T>();
+    }
+}
+
+template <class T>
+consteval bool is_struct_of_integers()
+{
+    // The fields of standard layout types are all in the same class, the
+    // struct or one of its bases, as needed to bind them.
+    if constexpr (!std::is_class_v<T> || !std::is_aggregate_v<T> ||
+                  !std::is_standard_layout_v<T>) {
+        return false;
+    } else {
+        constexpr auto n = count_initializers<T, false>();
+        if constexpr (n == 0 || n > max_fields ||
+                      n != count_initializers<T, true>()) {
+            return false;
+        } else {
+            return []<class... Fields>(type_list<Fields...>) {
+                return (is_field_of_integers<std::remove_cvref_t<Fields>>() &&
+                        ...);
+            }(decltype(field_types<n>(std::declval<T&>())){});
+        }
+    }
+}
+
+} // namespace immer_archive::detail
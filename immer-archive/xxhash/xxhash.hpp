@@ -1,6 +1,18 @@
 #pragma once
 
+#include <immer-archive/xxhash/fields.hpp>
+
+#include <boost/endian/conversion.hpp>
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 namespace immer_archive {
 
@@ -9,6 +21,112 @@ struct xx_hash;
 
 std::size_t xx_hash_value_string(const std::string& str);
 
+/**
+ * Hash a block of memory as it is, for values whose bytes are their identity.
+ */
+std::size_t xx_hash_bytes(const void* data, std::size_t size);
+
+/**
+ * Hash count values of size bytes each, stored one after the other, into
+ * hashes. Each hash is the same as xx_hash_bytes of the value.
+ */
+void xx_hash_bytes_batch(const void* data,
+                         std::size_t size,
+                         std::size_t count,
+                         std::size_t* hashes);
+
+namespace detail {
+
+/**
+ * Integers, enums and booleans are hashed as their little-endian bytes, so
+ * that their hash is the same on every platform.
+ */
+template <class T>
+constexpr bool is_hashed_as_integer_v =
+    std::is_integral_v<T> || std::is_enum_v<T>;
+
+/**
+ * Structs of integers without padding are hashed as they are in memory, their
+ * bytes are their identity. Their hash depends on the byte order and on the
+ * layout of the platform. Other types with unique object representations may
+ * hold pointers, a std::string_view hashed this way would hash where its
+ * characters are instead of what they are, so they're left out.
+ */
+template <class T>
+constexpr bool is_hashed_as_bytes_v = [] {
+    if constexpr (std::has_unique_object_representations_v<T> &&
+                  !is_std_array_v<T>) {
+        return is_struct_of_integers<T>();
+    } else {
+        return false;
+    }
+}();
+
+/**
+ * IEEE 754 floats and doubles are hashed as the little-endian bytes of their
+ * bits, like integers.
+ */
+template <class T>
+constexpr bool is_hashed_as_float_v =
+    std::is_floating_point_v<T> && std::numeric_limits<T>::is_iec559 &&
+    (sizeof(T) == sizeof(std::uint32_t) || sizeof(T) == sizeof(std::uint64_t));
+
+/**
+ * Whether integers are stored as their little-endian bytes, so that they can
+ * be hashed in place.
+ */
+template <class T>
+constexpr bool is_little_endian_v =
+    is_hashed_as_integer_v<T> &&
+    (sizeof(T) == 1 || std::endian::native == std::endian::little);
+
+template <class T>
+auto to_little_endian(T value)
+{
+    if constexpr (std::is_enum_v<T>) {
+        return to_little_endian(static_cast<std::underlying_type_t<T>>(value));
+    } else if constexpr (sizeof(T) == 1) {
+        return static_cast<unsigned char>(value);
+    } else {
+        return boost::endian::native_to_little(value);
+    }
+}
+
+} // namespace detail
+
+/**
+ * Hash a range of values, the same way on every platform as long as the hashes
+ * of the values are. Integers are hashed as one block of their little-endian
+ * bytes, and other values by hashing their hashes given by Hash. Values that
+ * are hashed as they are in memory are also hashed as one block, which
+ * depends on the platform like their own hash.
+ */
+template <class T, class Hash = xx_hash<T>>
+std::size_t xx_hash_range(const T* begin, const T* end)
+{
+    if constexpr (detail::is_little_endian_v<T> ||
+                  detail::is_hashed_as_bytes_v<T>) {
+        return xx_hash_bytes(begin, (end - begin) * sizeof(T));
+    } else if constexpr (detail::is_hashed_as_integer_v<T>) {
+        using little_t = decltype(detail::to_little_endian(*begin));
+        auto values    = std::vector<little_t>{};
+        values.reserve(end - begin);
+        for (auto p = begin; p != end; ++p) {
+            values.push_back(detail::to_little_endian(*p));
+        }
+        return xx_hash_bytes(values.data(), values.size() * sizeof(little_t));
+    } else {
+        auto hashes = std::vector<std::uint64_t>{};
+        hashes.reserve(end - begin);
+        for (auto p = begin; p != end; ++p) {
+            hashes.push_back(detail::to_little_endian(
+                static_cast<std::uint64_t>(Hash{}(*p))));
+        }
+        return xx_hash_bytes(hashes.data(),
+                             hashes.size() * sizeof(std::uint64_t));
+    }
+}
+
 template <class T, class U>
 using enable_for = std::enable_if_t<std::is_same_v<T, U>, std::size_t>;
 
@@ -18,10 +136,86 @@ enable_for<T, std::string> xx_hash_value(const T& str)
     return xx_hash_value_string(str);
 }
 
+template <class T>
+enable_for<T, std::string_view> xx_hash_value(const T& str)
+{
+    return xx_hash_bytes(str.data(), str.size());
+}
+
+template <class T>
+std::enable_if_t<detail::is_hashed_as_integer_v<T>, std::size_t>
+xx_hash_value(const T& val)
+{
+    const auto bytes = detail::to_little_endian(val);
+    return xx_hash_bytes(&bytes, sizeof(bytes));
+}
+
+/**
+ * 0.0 and -0.0 are equal, they are given the same hash.
+ */
+template <class T>
+std::enable_if_t<detail::is_hashed_as_float_v<T>, std::size_t>
+xx_hash_value(const T& val)
+{
+    using bits_t = std::conditional_t<sizeof(T) == sizeof(std::uint32_t),
+                                      std::uint32_t,
+                                      std::uint64_t>;
+
+    const auto bytes = detail::to_little_endian(
+        std::bit_cast<bits_t>(val == T{} ? T{} : val));
+    return xx_hash_bytes(&bytes, sizeof(bytes));
+}
+
+template <class T>
+std::enable_if_t<detail::is_hashed_as_bytes_v<T>, std::size_t>
+xx_hash_value(const T& val)
+{
+    return xx_hash_bytes(&val, sizeof(val));
+}
+
+/**
+ * Arrays are hashed like xx_hash_range hashes their values.
+ */
+template <class T>
+std::enable_if_t<detail::is_std_array_v<T>, std::size_t>
+xx_hash_value(const T& values)
+{
+    return xx_hash_range(values.data(), values.data() + values.size());
+}
+
 template <class T>
 struct xx_hash
 {
     std::size_t operator()(const T& val) const { return xx_hash_value(val); }
 };
 
+namespace detail {
+
+/**
+ * Whether Hash hashes each value as its bytes in memory.
+ */
+template <class T, class Hash>
+constexpr bool is_batch_of_bytes_v =
+    std::is_same_v<Hash, xx_hash<T>> &&
+    (is_hashed_as_bytes_v<T> || is_little_endian_v<T>);
+
+} // namespace detail
+
+/**
+ * Hash every value of a range into hashes, which has room for all of them. The
+ * values go through xxHash together when Hash hashes their bytes, and one by
+ * one otherwise.
+ */
+template <class T, class Hash = xx_hash<T>>
+void xx_hash_batch(const T* begin, const T* end, std::size_t* hashes)
+{
+    if constexpr (detail::is_batch_of_bytes_v<T, Hash>) {
+        xx_hash_bytes_batch(begin, sizeof(T), end - begin, hashes);
+    } else {
+        for (auto p = begin; p != end; ++p) {
+            *hashes++ = Hash{}(*p);
+        }
+    }
+}
+
 } // namespace immer_archive
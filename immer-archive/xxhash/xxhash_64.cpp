@@ -12,4 +12,20 @@ std::size_t xx_hash_value_string(const std::string& str)
     return XXH3_64bits(str.c_str(), str.size());
 }
 
+std::size_t xx_hash_bytes(const void* data, std::size_t size)
+{
+    return XXH3_64bits(data, size);
+}
+
+void xx_hash_bytes_batch(const void* data,
+                         std::size_t size,
+                         std::size_t count,
+                         std::size_t* hashes)
+{
+    const auto* bytes = static_cast<const char*>(data);
+    for (auto i = std::size_t{}; i < count; ++i) {
+        hashes[i] = XXH3_64bits(bytes + i * size, size);
+    }
+}
+
 } // namespace immer_archive
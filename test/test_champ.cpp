@@ -3,6 +3,8 @@
 #include <immer-archive/champ/champ.hpp>
 #include <immer-archive/xxhash/xxhash.hpp>
 
+#include <immer/memory_policy.hpp>
+
 #include "utils.hpp"
 
 #include <nlohmann/json.hpp>
@@ -769,4 +771,190 @@ TEST_CASE("Test modifying nodes with collisions")
         node["values"] = {"15", "16", "17", "14", "13", "12", "11"};
         REQUIRE(load_set(set_id) == expected_set.erase("18"));
     }
+    SECTION("Collision node must be at the maximum depth")
+    {
+        auto& node = data["value0"][18];
+        REQUIRE(node["collisions"] == true);
+        node["collisions"] = false;
+        REQUIRE_THROWS_AS(
+            load_set(set_id),
+            immer_archive::champ::invalid_collision_depth_exception);
+    }
+}
+
+TEST_CASE("Preload champ containers on several threads")
+{
+    using Container = immer::map<int, std::string>;
+
+    const auto map        = gen_map(Container{}, 1000);
+    const auto map2       = gen_map(map, 1500);
+    auto [ar, map_id]     = immer_archive::champ::save_to_archive(map, {});
+    auto map2_id          = immer_archive::node_id{};
+    std::tie(ar, map2_id) = immer_archive::champ::save_to_archive(map2, ar);
+
+    auto loader = immer_archive::champ::container_loader{to_load_archive(ar)};
+    loader.preload(4);
+
+    REQUIRE(loader.load(map_id) == map);
+    REQUIRE(loader.load(map2_id) == map2);
+    REQUIRE(loader.load(map_id).identity() == loader.load(map_id).identity());
+}
+
+TEST_CASE("Preloading skips the champ containers that fail to load")
+{
+    using Container = immer::map<int, std::string>;
+
+    const auto map    = gen_map(Container{}, 200);
+    auto [ar, map_id] = immer_archive::champ::save_to_archive(map, {});
+    auto load_ar      = to_load_archive(ar);
+
+    // A root whose nodemap promises a child that it doesn't have.
+    auto broken          = load_ar.nodes[map_id.value];
+    broken.children      = {};
+    const auto broken_id = node_id{load_ar.nodes.size()};
+    load_ar.nodes        = std::move(load_ar.nodes).push_back(broken);
+
+    auto loader = immer_archive::champ::container_loader{load_ar};
+    REQUIRE_NOTHROW(loader.preload(4));
+
+    REQUIRE(loader.load(map_id) == map);
+    REQUIRE_THROWS_AS(
+        loader.load(broken_id),
+        immer_archive::champ::children_count_corrupted_exception);
+}
+
+TEST_CASE("Save champ containers in parallel")
+{
+    using Container = immer::map<int, std::string>;
+
+    const auto map  = gen_map(Container{}, 1000);
+    const auto maps = std::vector<Container>{
+        map,
+        gen_map(map, 1500),
+        map.set(5000, "x"),
+        map,
+    };
+
+    auto ar  = immer_archive::champ::container_archive_save<Container>{};
+    auto ids = std::vector<node_id>{};
+    for (const auto& m : maps) {
+        auto id          = node_id{};
+        std::tie(ar, id) = immer_archive::champ::save_to_archive(m, ar);
+        ids.push_back(id);
+    }
+
+    const auto [parallel_ar, parallel_ids] =
+        immer_archive::champ::save_to_archive_parallel(maps, {}, 4);
+    REQUIRE(parallel_ids == ids);
+    REQUIRE(to_json(parallel_ar) == to_json(ar));
+}
+
+TEST_CASE("Champ nodes are saved in the order of their IDs")
+{
+    using Container = immer::map<int, std::string>;
+    using immer_archive::champ::container_archive_load;
+
+    const auto map = gen_map(Container{}, 1000);
+    const auto [ar, map_id] = immer_archive::champ::save_to_archive(map, {});
+    REQUIRE(map_id == node_id{});
+    REQUIRE(ar.nodes.inners.size() == ar.nodes.node_ptr_to_id.size());
+
+    // Children come after their parent in pre-order.
+    for (auto index = std::size_t{}; index < ar.nodes.inners.size(); ++index) {
+        for (const auto& child : ar.nodes.inners[index].children) {
+            REQUIRE(child.value > index);
+        }
+    }
+
+    REQUIRE(immer_archive::champ::to_load_archive(ar) ==
+            from_json<container_archive_load<Container>>(to_json(ar)));
+}
+
+TEST_CASE("Save only the new champ nodes into a delta archive")
+{
+    using Container = immer::map<int, std::string>;
+    using immer_archive::champ::container_archive_delta_load;
+    using immer_archive::champ::container_archive_load;
+
+    const auto map  = gen_map(Container{}, 1000);
+    const auto map2 = map.set(5000, "x");
+
+    const auto [base, map_id] = immer_archive::champ::save_to_archive(map, {});
+    const auto [ar, map2_id] = immer_archive::champ::save_to_archive(map2, base);
+
+    const auto delta = from_json<container_archive_delta_load<Container>>(
+        to_json(immer_archive::champ::make_delta(base, ar)));
+    REQUIRE(delta.base_nodes == base.nodes.inners.size());
+    REQUIRE(delta.nodes.size() < base.nodes.inners.size() / 4);
+
+    const auto loaded_base =
+        from_json<container_archive_load<Container>>(to_json(base));
+    const auto loaded = immer_archive::champ::apply_delta(loaded_base, delta);
+    REQUIRE(loaded == from_json<container_archive_load<Container>>(to_json(ar)));
+
+    auto loader = immer_archive::champ::container_loader{loaded};
+    REQUIRE(loader.load(map_id) == map);
+    REQUIRE(loader.load(map2_id) == map2);
+
+    SECTION("The delta doesn't apply to another base")
+    {
+        REQUIRE_THROWS_AS(
+            immer_archive::champ::apply_delta(
+                container_archive_load<Container>{}, delta),
+            immer_archive::invalid_delta_archive);
+    }
+}
+
+TEST_CASE("Hash validation can be turned off")
+{
+    using Container = immer::set<std::string, broken_hash>;
+
+    const auto set          = gen_set(Container{}, 200);
+    const auto [ar, set_id] = immer_archive::champ::save_to_archive(set, {});
+
+    using WrongContainer = immer::set<std::string>;
+    const auto loaded_archive =
+        from_json<immer_archive::champ::container_archive_load<WrongContainer>>(
+            to_json(ar));
+
+    auto loader = immer_archive::champ::container_loader{
+        loaded_archive,
+        {.mode = immer_archive::verify_policy::none},
+    };
+    REQUIRE(loader.load(set_id).size() == set.size());
+}
+
+TEST_CASE("Rebuild saved champ containers with another memory policy")
+{
+    using memory_policy =
+        immer::memory_policy<immer::heap_policy<immer::cpp_heap>,
+                             immer::unsafe_refcount_policy,
+                             immer::no_lock_policy>;
+    using Container = immer::map<int, std::string>;
+    using Rebuilt   = immer::map<int,
+                               std::string,
+                               std::hash<int>,
+                               std::equal_to<int>,
+                               memory_policy>;
+
+    const auto map  = gen_map(Container{}, 1000);
+    const auto map2 = map.set(5000, "x");
+
+    auto ar      = immer_archive::champ::container_archive_save<Container>{};
+    auto map_id  = node_id{};
+    auto map2_id = node_id{};
+    std::tie(ar, map_id)  = immer_archive::champ::save_to_archive(map, ar);
+    std::tie(ar, map2_id) = immer_archive::champ::save_to_archive(map2, ar);
+
+    const auto rebuilt = immer_archive::champ::rebuild_containers<Rebuilt>(ar);
+    REQUIRE(rebuilt.size() == 2);
+
+    const auto& rebuilt_map  = rebuilt[map_id];
+    const auto& rebuilt_map2 = rebuilt[map2_id];
+    REQUIRE(rebuilt_map.size() == map.size());
+    for (const auto& [key, value] : map) {
+        REQUIRE(rebuilt_map[key] == value);
+    }
+    REQUIRE(rebuilt_map2.size() == map2.size());
+    REQUIRE(rebuilt_map2[5000] == "x");
 }
@@ -1,3 +1,4 @@
+#include <immer-archive/binary/archivable.hpp>
 #include <immer-archive/json/archivable.hpp>
 #include <immer-archive/rbts/traits.hpp>
 
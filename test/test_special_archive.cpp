@@ -4,16 +4,28 @@
 #include <test/utils.hpp>
 
 #include <boost/hana.hpp>
+#include <immer-archive/array/traits.hpp>
+#include <immer-archive/binary/archivable.hpp>
+#include <immer-archive/binary/mapped_file.hpp>
+#include <immer-archive/box/traits.hpp>
 #include <immer-archive/champ/traits.hpp>
 #include <immer-archive/json/archivable.hpp>
 #include <immer-archive/json/json_with_archive.hpp>
 #include <immer-archive/rbts/traits.hpp>
 
+#include <cereal/archives/binary.hpp>
 // to save std::pair
 #include <cereal/types/utility.hpp>
 
 #include <boost/hana/ext/std/tuple.hpp>
 
+#include <nlohmann/json.hpp>
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+
 namespace {
 
 namespace hana = boost::hana;
@@ -179,6 +191,66 @@ inline auto get_archives_types(const std::pair<test_data, test_data>&)
     return get_archives_types(test_data{});
 }
 
+struct ids_data
+{
+    immer_archive::archivable<immer::set<std::string>> ids;
+    immer_archive::archivable<immer::set<std::string>> next_ids;
+
+    friend bool operator==(const ids_data& left, const ids_data& right)
+    {
+        return std::tie(left.ids, left.next_ids) ==
+               std::tie(right.ids, right.next_ids);
+    }
+
+    template <class Archive>
+    void serialize(Archive& ar)
+    {
+        ar(CEREAL_NVP(ids), CEREAL_NVP(next_ids));
+    }
+};
+
+inline auto get_archives_types(const ids_data&)
+{
+    return hana::make_map(hana::make_pair(
+        hana::type_c<immer::set<std::string>>, BOOST_HANA_STRING("ids")));
+}
+
+/**
+ * Boxes and arrays referenced from several places.
+ */
+struct shared_data
+{
+    immer_archive::archivable<immer::box<std::string>> box;
+    immer_archive::archivable<immer::box<std::string>> same_box;
+    immer_archive::archivable<immer::array<int>> array;
+    immer_archive::archivable<immer::array<int>> same_array;
+
+    auto tie() const { return std::tie(box, same_box, array, same_array); }
+
+    friend bool operator==(const shared_data& left, const shared_data& right)
+    {
+        return left.tie() == right.tie();
+    }
+
+    template <class Archive>
+    void serialize(Archive& ar)
+    {
+        ar(CEREAL_NVP(box),
+           CEREAL_NVP(same_box),
+           CEREAL_NVP(array),
+           CEREAL_NVP(same_array));
+    }
+};
+
+inline auto get_archives_types(const shared_data&)
+{
+    return hana::make_map(
+        hana::make_pair(hana::type_c<immer::box<std::string>>,
+                        BOOST_HANA_STRING("boxes")),
+        hana::make_pair(hana::type_c<immer::array<int>>,
+                        BOOST_HANA_STRING("arrays")));
+}
+
 } // namespace
 
 template <>
@@ -266,6 +338,47 @@ TEST_CASE("Special archive minimal test")
     }
 }
 
+TEST_CASE("Special archive loads archives in any order")
+{
+    const auto ints1      = vector_one<int>{1, 2, 3};
+    const auto meta_value = meta{
+        .ints = ints1,
+        .metas =
+            {
+                meta_meta{
+                    .ints = ints1,
+                },
+            },
+    };
+    const auto test1 = test_data{
+        .ints  = ints1,
+        .metas = {meta_value},
+        .metas_map =
+            {
+                {234, meta_value},
+            },
+    };
+
+    const auto [json_str, archives] =
+        immer_archive::to_json_with_archive(test1);
+
+    // Archives that depend on other archives come first, the dependencies must
+    // be loaded on demand.
+    const auto data = nlohmann::ordered_json::parse(json_str);
+    auto reversed   = nlohmann::ordered_json::object();
+    for (auto it = data["archives"].rbegin(); it != data["archives"].rend();
+         ++it) {
+        reversed[it.key()] = it.value();
+    }
+    auto reordered        = nlohmann::ordered_json::object();
+    reordered["value0"]   = data["value0"];
+    reordered["archives"] = reversed;
+
+    const auto loaded =
+        immer_archive::from_json_with_archive<test_data>(reordered.dump());
+    REQUIRE(loaded == test1);
+}
+
 TEST_CASE("Save with a special archive")
 {
     spdlog::set_level(spdlog::level::debug);
@@ -564,3 +677,247 @@ TEST_CASE("Special archive throws cereal::Exception")
         Catch::Matchers::Message("Failed to load a container ID 99 from the "
                                  "archive: Container ID 99 is not found"));
 }
+
+TEST_CASE("Save and load with a binary special archive")
+{
+    const auto ints1 = test::gen(test::example_vector{}, 3);
+    const auto ints5 = vector_one<int>{1, 2, 3, 4, 5};
+    const auto meta_value = meta{
+        .ints = ints5,
+        .metas =
+            {
+                meta_meta{
+                    .ints  = ints1,
+                    .table = {test_value{1, "one"}, test_value{2, "two"}},
+                },
+            },
+    };
+    const auto test1 = test_data{
+        .ints      = ints1,
+        .strings   = {"one", "two"},
+        .flex_ints = flex_vector_one<int>{ints1},
+        .map =
+            {
+                {1, "_one_"},
+                {2, "two__"},
+            },
+        .metas = {meta_value},
+        .metas_map =
+            {
+                {234, meta_value},
+            },
+        .vectors_map =
+            {
+                {234, {2, 3, 4}},
+                {789, ints1},
+            },
+        .single_meta = meta_value,
+    };
+    const auto test2 = test_data{
+        .ints      = ints1,
+        .strings   = {"three"},
+        .flex_ints = flex_vector_one<int>{ints1},
+        .metas     = {meta_value},
+    };
+
+    const auto [binary_str, archives] =
+        immer_archive::to_binary_with_archive(std::make_pair(test1, test2));
+
+    // Same data, fewer bytes than JSON.
+    REQUIRE(binary_str.size() <
+            immer_archive::to_json_with_archive(std::make_pair(test1, test2))
+                .first.size());
+
+    const auto [loaded1, loaded2] = immer_archive::from_binary_with_archive<
+        std::pair<test_data, test_data>>(binary_str);
+    REQUIRE(loaded1 == test1);
+    REQUIRE(loaded2 == test2);
+
+    // Structural sharing is preserved.
+    REQUIRE(loaded1.ints.container.identity() ==
+            loaded2.ints.container.identity());
+    REQUIRE(loaded1.metas.container.identity() ==
+            loaded2.metas.container.identity());
+}
+
+TEST_CASE("Restores given the same node pools share their nodes")
+{
+    const auto ints  = test::gen(test::example_vector{}, 1000);
+    const auto value = test_data{
+        .ints      = ints,
+        .flex_ints = flex_vector_one<int>{ints}.push_back(1),
+    };
+
+    auto pools = std::make_shared<immer_archive::node_pools>();
+    pools->add<vector_one<int>>();
+    pools->add<flex_vector_one<int>>();
+
+    const auto json_str   = immer_archive::to_json_with_archive(value).first;
+    const auto binary_str = immer_archive::to_binary_with_archive(value).first;
+
+    const auto loaded1 =
+        immer_archive::from_json_with_archive<test_data>(json_str, {}, pools);
+    const auto loaded2 =
+        immer_archive::from_json_with_archive<test_data>(json_str, {}, pools);
+    const auto loaded3 = immer_archive::from_binary_with_archive<test_data>(
+        binary_str, {}, pools);
+    REQUIRE(loaded1 == value);
+    REQUIRE(loaded2 == value);
+    REQUIRE(loaded3 == value);
+
+    const auto root = loaded1.ints.container.impl().root;
+    REQUIRE(loaded2.ints.container.impl().root == root);
+    REQUIRE(loaded3.ints.container.impl().root == root);
+    REQUIRE(loaded2.flex_ints.container.impl().root ==
+            loaded1.flex_ints.container.impl().root);
+
+    SECTION("Without pools, every restore has its own nodes")
+    {
+        const auto loaded =
+            immer_archive::from_json_with_archive<test_data>(json_str);
+        REQUIRE(loaded == value);
+        REQUIRE(loaded.ints.container.impl().root != root);
+    }
+}
+
+TEST_CASE("Binary special archive must load and save types that have no "
+          "archive")
+{
+    const auto value = std::make_pair(test_value{123, "value1"},
+                                      test_value{234, "value2"});
+
+    const auto binary_str = immer_archive::to_binary_with_archive(value).first;
+    const auto loaded     = immer_archive::from_binary_with_archive<
+        std::decay_t<decltype(value)>>(binary_str);
+    REQUIRE(loaded == value);
+}
+
+TEST_CASE("Binary values with a corrupted size are not allocated upfront")
+{
+    auto os = std::ostringstream{};
+    {
+        auto ar = cereal::BinaryOutputArchive{os};
+        ar(cereal::make_size_tag(cereal::size_type{1} << 60));
+        ar(1, 2, 3);
+    }
+
+    auto is     = std::istringstream{os.str()};
+    auto ar     = cereal::BinaryInputArchive{is};
+    auto values = immer_archive::values_load<int>{};
+    REQUIRE_THROWS_AS(ar(values), cereal::Exception);
+}
+
+TEST_CASE("Load a binary special archive from a mapped file")
+{
+    const auto ints  = test::gen(test::example_vector{}, 10'000);
+    const auto value = test_data{
+        .ints      = ints,
+        .flex_ints = flex_vector_one<int>{ints}.push_back(1),
+    };
+
+    // Tests may run in parallel, each one gets its own file.
+    const auto path =
+        std::filesystem::temp_directory_path() /
+        fmt::format("immer-archive-test-mapped-file-{}.bin",
+                    std::random_device{}());
+    struct remove_file
+    {
+        std::filesystem::path path;
+
+        ~remove_file()
+        {
+            auto error = std::error_code{};
+            std::filesystem::remove(path, error);
+        }
+    };
+    const auto cleanup = remove_file{path};
+
+    {
+        // Written straight into the file.
+        auto os = std::ofstream{path, std::ios::binary};
+        immer_archive::to_binary_with_archive(os, value);
+    }
+
+    {
+        const auto file   = immer_archive::mapped_file{path.string()};
+        const auto loaded =
+            immer_archive::from_binary_with_archive<test_data>(file.data());
+        REQUIRE(loaded == value);
+    }
+    std::filesystem::remove(path);
+
+    REQUIRE_THROWS_AS(immer_archive::mapped_file{path.string()},
+                      std::system_error);
+}
+
+TEST_CASE("Save and load sets with a special archive")
+{
+    auto ids = immer::set<std::string>{};
+    for (auto i = 0; i < 1000; ++i) {
+        ids = std::move(ids).insert(fmt::format("id_{}", i));
+    }
+    const auto value = ids_data{
+        .ids      = ids,
+        .next_ids = ids.insert("id_new"),
+    };
+
+    auto [json_str, archives] = immer_archive::to_json_with_archive(value);
+    REQUIRE(immer_archive::from_json_with_archive<ids_data>(json_str) ==
+            value);
+
+    const auto binary_str = immer_archive::to_binary_with_archive(value).first;
+    REQUIRE(immer_archive::from_binary_with_archive<ids_data>(binary_str) ==
+            value);
+
+    // Both sets share most of their nodes.
+    auto [single_json_str, single_archives] =
+        immer_archive::to_json_with_archive(ids_data{.ids = ids});
+    const auto single_nodes =
+        single_archives.get_save_archive<immer::set<std::string>>()
+            .nodes.inners.size();
+    const auto nodes = archives.get_save_archive<immer::set<std::string>>()
+                           .nodes.inners.size();
+    REQUIRE(nodes > single_nodes);
+    REQUIRE(nodes < single_nodes + single_nodes / 4);
+}
+
+TEST_CASE("Boxes and arrays are saved once however many times they're used")
+{
+    using box_t   = immer::box<std::string>;
+    using array_t = immer::array<int>;
+
+    const auto box   = box_t{"a long blob"};
+    const auto array = array_t{1, 2, 3, 4, 5};
+    const auto value = shared_data{
+        .box        = box,
+        .same_box   = box,
+        .array      = array,
+        .same_array = array,
+    };
+
+    auto [json_str, archives] = immer_archive::to_json_with_archive(value);
+    REQUIRE(archives.get_save_archive<box_t>().boxes.size() == 1);
+    REQUIRE(archives.get_save_archive<array_t>().arrays.size() == 1);
+
+    const auto check = [&](const shared_data& loaded) {
+        REQUIRE(loaded == value);
+        REQUIRE(&loaded.box.container.get() ==
+                &loaded.same_box.container.get());
+        REQUIRE(loaded.array.container.data() ==
+                loaded.same_array.container.data());
+    };
+    check(immer_archive::from_json_with_archive<shared_data>(json_str));
+    check(immer_archive::from_binary_with_archive<shared_data>(
+        immer_archive::to_binary_with_archive(value).first));
+
+    // Equal but distinct values are saved separately.
+    const auto other = shared_data{
+        .box        = box,
+        .same_box   = box_t{"a long blob"},
+        .array      = array,
+        .same_array = array.push_back(6),
+    };
+    auto other_archives = immer_archive::to_json_with_archive(other).second;
+    REQUIRE(other_archives.get_save_archive<box_t>().boxes.size() == 2);
+    REQUIRE(other_archives.get_save_archive<array_t>().arrays.size() == 2);
+}
@@ -14,6 +14,8 @@
 
 #include <test/utils.hpp>
 
+#include <immer/memory_policy.hpp>
+
 #include <boost/hana.hpp>
 #include <boost/hana/ext/std/tuple.hpp>
 #include <spdlog/spdlog.h>
@@ -379,7 +381,7 @@ TEST_CASE("Test flex vectors memory leak")
          * an inner node AND its children which also must be inner nodes.
          *
          * It's not that easy because if a child is a leaf, leaves are stored in
-         * the separate map `immer::map<node_id, node_ptr> leaves_` and
+         * the separate map `immer::map<node_id, node_t*> leaves_` and
          * therefore, will never be deallocated by an inner node.
          *
          * So it must be an inner node that has the last pointer to another
@@ -1543,3 +1545,471 @@ TEST_CASE("Can't load saved flex vector with relaxed nodes as strict")
             immer_archive::rbts::relaxed_node_not_allowed_exception);
     }
 }
+
+TEST_CASE("Preload vectors on several threads")
+{
+    const auto v1      = gen(example_vector{}, 1000);
+    const auto v2      = v1.push_back(900);
+    const auto vectors = std::vector<example_vector>{v1, v2, gen(v2, 300)};
+
+    auto ar  = example_archive_save{};
+    auto ids = std::vector<immer_archive::container_id>{};
+    for (const auto& v : vectors) {
+        auto [ar2, id] = save_to_archive(v, ar);
+        ar             = ar2;
+        ids.push_back(id);
+    }
+
+    auto loader = immer_archive::rbts::make_loader_for(example_vector{},
+                                                       fix_leaf_nodes(ar));
+    loader.preload(4);
+
+    for (auto index = std::size_t{}; index < vectors.size(); ++index) {
+        REQUIRE(loader.load(ids[index]) == vectors[index]);
+    }
+    REQUIRE(loader.load(ids[0]).identity() == loader.load(ids[0]).identity());
+}
+
+TEST_CASE("Preloading skips the vectors that fail to load")
+{
+    const auto vec    = gen(example_vector{}, 100);
+    auto [ar, vec_id] = save_to_archive(vec, example_archive_save{});
+
+    // A vector whose root is not in the archive.
+    auto load_ar         = fix_leaf_nodes(ar);
+    const auto tail      = load_ar.vectors[vec_id.value].tail;
+    const auto broken_id = immer_archive::container_id{load_ar.vectors.size()};
+    load_ar.vectors      = std::move(load_ar.vectors)
+                          .push_back({
+                              .root = immer_archive::node_id{9999},
+                              .tail = tail,
+                          });
+
+    auto loader =
+        immer_archive::rbts::make_loader_for(example_vector{}, load_ar);
+    REQUIRE_NOTHROW(loader.preload(4));
+
+    REQUIRE(loader.load(vec_id) == vec);
+    REQUIRE_THROWS_AS(loader.load(broken_id), immer_archive::invalid_node_id);
+}
+
+TEST_CASE("Save vectors in parallel")
+{
+    const auto v1           = gen(example_vector{}, 1000);
+    const auto v2           = v1.push_back(900);
+    const auto flex_vectors = std::vector<example_flex_vector>{
+        v1,
+        v2,
+        example_flex_vector{v1} + v2,
+        v2,
+        gen(example_flex_vector{}, 100) + v1,
+    };
+
+    auto ar  = example_archive_save{};
+    auto ids = std::vector<immer_archive::container_id>{};
+    for (const auto& v : flex_vectors) {
+        auto [ar2, id] = save_to_archive(v, ar);
+        ar             = ar2;
+        ids.push_back(id);
+    }
+
+    const auto [parallel_ar, parallel_ids] =
+        immer_archive::rbts::save_to_archive_parallel(
+            flex_vectors, example_archive_save{}, 4);
+    REQUIRE(parallel_ids == ids);
+    REQUIRE(to_json(parallel_ar) == to_json(ar));
+}
+
+TEST_CASE("Save vectors that see shared nodes differently in parallel")
+{
+    // The shorter vectors share the tail or inner nodes of the longer one,
+    // with fewer of their values or children in use.
+    const auto v       = gen(example_vector{}, 1000);
+    const auto vectors = std::vector<example_vector>{
+        v.take(999),
+        v,
+        v.take(500),
+        v.take(501),
+    };
+
+    auto ar  = example_archive_save{};
+    auto ids = std::vector<immer_archive::container_id>{};
+    for (const auto& vec : vectors) {
+        auto [ar2, id] = save_to_archive(vec, ar);
+        ar             = ar2;
+        ids.push_back(id);
+    }
+
+    // Whichever thread gets to a shared node first, the result is the same.
+    for (auto i = 0; i < 20; ++i) {
+        const auto [parallel_ar, parallel_ids] =
+            immer_archive::rbts::save_to_archive_parallel(
+                vectors, example_archive_save{}, 4);
+        REQUIRE(parallel_ids == ids);
+        REQUIRE(to_json(parallel_ar) == to_json(ar));
+    }
+}
+
+TEST_CASE("Save only the new nodes into a delta archive")
+{
+    using immer_archive::rbts::archive_delta_load;
+    using immer_archive::rbts::archive_load;
+
+    const auto v1 = gen(example_vector{}, 1000);
+    const auto v2 = v1.push_back(900);
+    const auto v3 = v2.push_back(901);
+
+    const auto [base, v1_id] = save_to_archive(v1, example_archive_save{});
+    const auto [ar2, v2_id]  = save_to_archive(v2, base);
+    const auto [ar3, v3_id]  = save_to_archive(v3, ar2);
+
+    const auto delta2 = from_json<archive_delta_load<int>>(
+        to_json(immer_archive::rbts::make_delta(base, ar2)));
+    const auto delta3 = from_json<archive_delta_load<int>>(
+        to_json(immer_archive::rbts::make_delta(ar2, ar3)));
+    REQUIRE(delta2.archive.vectors.size() == 1);
+    REQUIRE(delta2.archive.leaves.size() + delta2.archive.inners.size() <
+            base.leaves.size() / 10);
+
+    const auto loaded_base = from_json<archive_load<int>>(to_json(base));
+    const auto loaded = immer_archive::rbts::apply_delta(
+        immer_archive::rbts::apply_delta(loaded_base, delta2), delta3);
+    REQUIRE(loaded == from_json<archive_load<int>>(to_json(ar3)));
+
+    auto loader = immer_archive::rbts::make_loader_for(example_vector{}, loaded);
+    REQUIRE(loader.load(v1_id) == v1);
+    REQUIRE(loader.load(v2_id) == v2);
+    REQUIRE(loader.load(v3_id) == v3);
+
+    SECTION("Deltas must be applied in order")
+    {
+        REQUIRE_THROWS_AS(immer_archive::rbts::apply_delta(loaded_base, delta3),
+                          immer_archive::invalid_delta_archive);
+    }
+}
+
+TEST_CASE("Loader keeps working after finding a cycle")
+{
+    json_t data;
+    data["value0"]["leaves"] = {
+        {{"key", 1}, {"value", {6}}},
+        {{"key", 2}, {"value", {0, 1}}},
+        {{"key", 3}, {"value", {2, 3}}},
+        {{"key", 4}, {"value", {4, 5}}},
+    };
+    data["value0"]["inners"] = {
+        {{"key", 0},
+         {"value", {{"children", {2, 3, 4}}, {"relaxed", false}}}},
+        {{"key", 5},
+         {"value", {{"children", {2, 5, 4}}, {"relaxed", false}}}},
+    };
+    data["value0"]["vectors"] = {
+        {{"root", 5}, {"tail", 1}},
+        {{"root", 0}, {"tail", 1}},
+    };
+
+    const auto archive =
+        test::from_json<immer_archive::rbts::archive_load<int>>(data.dump());
+    auto loader =
+        immer_archive::rbts::make_loader_for(test::example_vector{}, archive);
+    REQUIRE_THROWS_AS(loader.load(container_id{0}),
+                      immer_archive::archive_has_cycles);
+    REQUIRE(loader.load(container_id{1}) ==
+            test::vector_one<int>{0, 1, 2, 3, 4, 5, 6});
+}
+
+TEST_CASE("Choose how much of the loaded vectors is verified")
+{
+    using immer_archive::verify_policy;
+
+    json_t data;
+    data["value0"]["leaves"] = {
+        {{"key", 1}, {"value", {6}}},
+        {{"key", 2}, {"value", {0, 1}}},
+        {{"key", 3}, {"value", {2, 3}}},
+        {{"key", 4}, {"value", {4, 5}}},
+    };
+    data["value0"]["inners"] = {
+        {{"key", 0},
+         {"value", {{"children", {2, 3, 4}}, {"relaxed", false}}}},
+    };
+    data["value0"]["vectors"] = {
+        {{"root", 0}, {"tail", 1}},
+    };
+
+    const auto mode = GENERATE(verify_policy::full,
+                               verify_policy::structural,
+                               verify_policy::sampled,
+                               verify_policy::none);
+
+    const auto make_loader = [&] {
+        const auto archive =
+            test::from_json<immer_archive::rbts::archive_load<int>>(
+                data.dump());
+        return immer_archive::rbts::make_loader_for(
+            test::example_vector{},
+            archive,
+            {.mode = mode, .sample_period = 2});
+    };
+
+    SECTION("A valid archive loads")
+    {
+        auto loader = make_loader();
+        for (auto i = 0; i < 3; ++i) {
+            REQUIRE(loader.load(container_id{0}) ==
+                    test::vector_one<int>{0, 1, 2, 3, 4, 5, 6});
+        }
+    }
+
+    SECTION("A leaf that is too short is rejected while loading")
+    {
+        // Leaf #3 should have two elements, but it has only one.
+        data["value0"]["leaves"][2]["value"] = {2};
+
+        auto loader = make_loader();
+        for (auto i = 0; i < 3; ++i) {
+            REQUIRE_THROWS_AS(loader.load(container_id{0}),
+                              immer_archive::rbts::vector_corrupted_exception);
+        }
+    }
+
+    SECTION("The last leaf under the root must be full too")
+    {
+        // The tail takes the missing element, the size stays the same.
+        data["value0"]["leaves"][3]["value"] = {4};
+        data["value0"]["leaves"][0]["value"] = {5, 6};
+
+        auto loader = make_loader();
+        REQUIRE_THROWS_AS(loader.load(container_id{0}),
+                          immer_archive::rbts::vector_corrupted_exception);
+    }
+
+    SECTION("The tail must hold the values past the last leaf")
+    {
+        data["value0"]["leaves"][0]["value"] = json_t::array();
+
+        auto loader = make_loader();
+        REQUIRE_THROWS_AS(loader.load(container_id{0}),
+                          immer_archive::rbts::vector_corrupted_exception);
+    }
+}
+
+TEST_CASE("Load vectors straight from the save archive")
+{
+    const auto vec      = gen(example_vector{}, 1000);
+    const auto flex_vec = gen(example_flex_vector{}, 500) + vec;
+
+    auto ar                   = example_archive_save{};
+    auto vec_id               = immer_archive::container_id{};
+    auto flex_vec_id          = immer_archive::container_id{};
+    std::tie(ar, vec_id)      = save_to_archive(vec, ar);
+    std::tie(ar, flex_vec_id) = save_to_archive(flex_vec, ar);
+
+    auto loader = example_loader{ar};
+    REQUIRE(loader.load_vector(vec_id) == vec);
+    REQUIRE(loader.load_flex_vector(flex_vec_id) == flex_vec);
+
+    SECTION("The loaded leaves don't depend on the archive")
+    {
+        auto preloaded = std::make_optional(
+            immer_archive::rbts::make_loader_for(vec, std::move(ar)));
+        preloaded->preload(4);
+        const auto loaded = preloaded->load(vec_id);
+        preloaded.reset();
+        REQUIRE(loaded == vec);
+    }
+}
+
+TEST_CASE("Rebuild saved vectors with another memory policy")
+{
+    using memory_policy =
+        immer::memory_policy<immer::heap_policy<immer::cpp_heap>,
+                             immer::unsafe_refcount_policy,
+                             immer::no_lock_policy>;
+    using rebuilt_vector =
+        immer::flex_vector<int, memory_policy, immer::default_bits, 1>;
+
+    const auto vec  = gen(example_vector{}, 1001);
+    const auto vec2 = vec.push_back(5);
+    REQUIRE(vec.impl().root == vec2.impl().root);
+
+    auto ar           = example_archive_save{};
+    auto id           = immer_archive::container_id{};
+    auto id2          = immer_archive::container_id{};
+    std::tie(ar, id)  = save_to_archive(vec, ar);
+    std::tie(ar, id2) = save_to_archive(vec2, ar);
+
+    const auto rebuilt =
+        immer_archive::rbts::rebuild_containers<rebuilt_vector>(ar);
+    REQUIRE(rebuilt.size() == 2);
+    REQUIRE(rebuilt[id.value] == rebuilt_vector{vec.begin(), vec.end()});
+    REQUIRE(rebuilt[id2.value] == rebuilt_vector{vec2.begin(), vec2.end()});
+    REQUIRE(rebuilt[id.value].impl().root == rebuilt[id2.value].impl().root);
+}
+
+TEST_CASE("Merge the nodes of separately built vectors with equal contents")
+{
+    using immer_archive::rbts::save_to_archive_deduplicated;
+
+    const auto vec      = gen(example_vector{}, 1000);
+    const auto same_vec = gen(example_vector{}, 1000);
+    const auto longer   = gen(example_vector{}, 1100);
+    const auto flex_vec =
+        gen(example_flex_vector{}, 500) + gen(example_flex_vector{}, 500);
+    const auto plain_ids = save_to_archive(vec, {}).first.node_ptr_to_id.size();
+
+    auto ar                 = example_archive_save{};
+    auto id                 = immer_archive::container_id{};
+    auto same_id            = immer_archive::container_id{};
+    auto longer_id          = immer_archive::container_id{};
+    auto flex_id            = immer_archive::container_id{};
+    std::tie(ar, id)        = save_to_archive_deduplicated(vec, ar);
+    std::tie(ar, same_id)   = save_to_archive_deduplicated(same_vec, ar);
+    std::tie(ar, longer_id) = save_to_archive_deduplicated(longer, ar);
+    std::tie(ar, flex_id)   = save_to_archive_deduplicated(flex_vec, ar);
+
+    REQUIRE(same_id == id);
+    // The other vectors mostly reuse the leaves of the first one.
+    REQUIRE(ar.node_ptr_to_id.size() < plain_ids + plain_ids / 4);
+
+    auto loader = example_loader{
+        test::from_json<immer_archive::rbts::archive_load<int>>(
+            test::to_json(ar))};
+    const auto loaded = loader.load_vector(id);
+    REQUIRE(loaded == vec);
+    REQUIRE(loader.load_vector(longer_id) == longer);
+    REQUIRE(loader.load_flex_vector(flex_id) == flex_vec);
+    REQUIRE(loaded.impl().root == loader.load_vector(same_id).impl().root);
+
+    SECTION("Values that are not plain bytes are hashed")
+    {
+        using strings_t = vector_one<std::string>;
+
+        auto strings_ar =
+            immer_archive::rbts::make_save_archive_for(strings_t{});
+        auto first_id   = immer_archive::container_id{};
+        auto second_id  = immer_archive::container_id{};
+        std::tie(strings_ar, first_id) = save_to_archive_deduplicated(
+            strings_t{"one", "two", "three"}, strings_ar);
+        std::tie(strings_ar, second_id) = save_to_archive_deduplicated(
+            strings_t{"one", "two", "three"}, strings_ar);
+        REQUIRE(first_id == second_id);
+    }
+}
+
+TEST_CASE("Vectors merged into an equal one are kept alive by the archive")
+{
+    using immer_archive::rbts::save_to_archive_deduplicated;
+
+    const auto vec   = gen(example_vector{}, 100);
+    auto ar          = example_archive_save{};
+    auto id          = immer_archive::container_id{};
+    std::tie(ar, id) = save_to_archive_deduplicated(vec, ar);
+    {
+        // The nodes of this temporary are merged into the ones of vec.
+        auto same_id          = immer_archive::container_id{};
+        std::tie(ar, same_id) = save_to_archive_deduplicated(
+            gen(example_vector{}, 100), ar);
+        REQUIRE(same_id == id);
+    }
+    REQUIRE(ar.saved_vectors.size() == 2);
+
+    // New nodes can't be given the addresses of the merged ones.
+    auto others = std::vector<std::pair<example_vector, container_id>>{};
+    for (auto i = 0; i < 10; ++i) {
+        auto other = example_vector{};
+        for (auto j = 0; j < 100; ++j) {
+            other = std::move(other).push_back(j * 1000 + i);
+        }
+        auto other_id          = immer_archive::container_id{};
+        std::tie(ar, other_id) = save_to_archive_deduplicated(other, ar);
+        REQUIRE(other_id != id);
+        others.emplace_back(std::move(other), other_id);
+    }
+
+    auto loader = example_loader{
+        test::from_json<immer_archive::rbts::archive_load<int>>(
+            test::to_json(ar))};
+    REQUIRE(loader.load_vector(id) == vec);
+    for (const auto& [other, other_id] : others) {
+        REQUIRE(loader.load_vector(other_id) == other);
+    }
+}
+
+TEST_CASE("Loaders share the nodes they create through a node pool")
+{
+    using pool_t = immer_archive::rbts::
+        node_pool<int, immer::default_memory_policy, immer::default_bits, 1>;
+
+    const auto vec      = gen(example_vector{}, 1000);
+    const auto same_vec = gen(example_vector{}, 1000);
+    const auto flex_vec = gen(example_flex_vector{}, 1000);
+
+    const auto [ar, id]           = save_to_archive(vec, {});
+    const auto [same_ar, same_id] = save_to_archive(same_vec, {});
+    const auto [flex_ar, flex_id] = save_to_archive(flex_vec, {});
+
+    const auto to_load_archive = [](const auto& archive) {
+        return test::from_json<immer_archive::rbts::archive_load<int>>(
+            test::to_json(archive));
+    };
+
+    auto pool         = std::make_shared<pool_t>();
+    const auto loaded = example_loader{to_load_archive(ar), {}, pool}
+                            .load_vector(id);
+    REQUIRE(loaded == vec);
+    const auto pooled_nodes = pool->size();
+    REQUIRE(pooled_nodes > 0);
+
+    auto loader = example_loader{to_load_archive(same_ar), {}, pool};
+    REQUIRE(loader.load_vector(same_id).impl().root == loaded.impl().root);
+    REQUIRE(pool->size() == pooled_nodes);
+
+    SECTION("Preloaded leaves are shared too")
+    {
+        auto preloaded = immer_archive::rbts::make_loader_for(
+            flex_vec, to_load_archive(flex_ar), {}, pool);
+        preloaded.preload(4);
+        const auto loaded_flex = preloaded.load(flex_id);
+        REQUIRE(loaded_flex == flex_vec);
+        // The flex vector has the same values as the vector.
+        REQUIRE(loaded_flex.impl().tail == loaded.impl().tail);
+    }
+}
+
+TEST_CASE("Trim the nodes that only the node pool uses")
+{
+    using pool_t = immer_archive::rbts::
+        node_pool<int, immer::default_memory_policy, immer::default_bits, 1>;
+
+    const auto vec    = gen(example_vector{}, 1000);
+    const auto longer = gen(example_vector{}, 1100);
+
+    const auto load = [](const auto& vector, const auto& pool) {
+        const auto [ar, id] = save_to_archive(vector, {});
+        auto loader         = example_loader{
+            test::from_json<immer_archive::rbts::archive_load<int>>(
+                test::to_json(ar)),
+            {},
+            pool,
+        };
+        return loader.load_vector(id);
+    };
+
+    auto pool         = std::make_shared<pool_t>();
+    const auto loaded = load(vec, pool);
+    const auto nodes  = pool->size();
+    {
+        const auto loaded_longer = load(longer, pool);
+        REQUIRE(loaded_longer == longer);
+        REQUIRE(pool->size() > nodes);
+        REQUIRE(pool->trim() == 0);
+    }
+
+    // Only the nodes of the longer vector that are not shared with the other
+    // one go away.
+    REQUIRE(pool->trim() > 0);
+    REQUIRE(pool->size() == nodes);
+    REQUIRE(loaded == vec);
+    REQUIRE(load(vec, pool).impl().root == loaded.impl().root);
+}
@@ -17,6 +17,18 @@ const auto gen_map = [](auto map, int count) {
     }
     return map;
 };
+
+struct point
+{
+    std::int32_t x;
+    std::int32_t y;
+};
+
+struct named_point
+{
+    const char* name;
+    point p;
+};
 }
 
 TEST_CASE("Test hash strings")
@@ -31,6 +43,94 @@ TEST_CASE("Test hash strings")
     REQUIRE(XXH3_64bits(str.c_str(), str.size()) == 10760762337991515389UL);
 }
 
+TEST_CASE("Test hash integers, arrays and plain structs")
+{
+    using immer_archive::xx_hash;
+    using int_array = std::array<std::int32_t, 3>;
+
+    // Integers are hashed as little-endian on every platform.
+    const auto little_endian = std::array<unsigned char, 4>{4, 3, 2, 1};
+    REQUIRE(xx_hash<std::uint32_t>{}(0x01020304) ==
+            XXH3_64bits(little_endian.data(), little_endian.size()));
+
+    REQUIRE(xx_hash<std::string_view>{}("hello") == 10760762337991515389UL);
+
+    // Arrays of integers are hashed as the little-endian bytes of their
+    // values, and other arrays as the little-endian bytes of the hashes of
+    // their values.
+    const auto values_bytes =
+        std::array<unsigned char, 12>{1, 0, 0, 0, 2, 0, 0, 0, 3, 0, 0, 0};
+    REQUIRE(xx_hash<int_array>{}(int_array{1, 2, 3}) ==
+            XXH3_64bits(values_bytes.data(), values_bytes.size()));
+
+    using string_array = std::array<std::string, 2>;
+    auto hashes_bytes  = std::vector<unsigned char>{};
+    for (const auto& str : {"one", "two"}) {
+        const auto hash = xx_hash<std::string>{}(str);
+        for (auto i = 0; i < 8; ++i) {
+            hashes_bytes.push_back(static_cast<unsigned char>(hash >> 8 * i));
+        }
+    }
+    REQUIRE(xx_hash<string_array>{}(string_array{"one", "two"}) ==
+            XXH3_64bits(hashes_bytes.data(), hashes_bytes.size()));
+
+    // Structs are hashed as they are in memory, which depends on the
+    // platform.
+    const auto p = point{1, 2};
+    REQUIRE(xx_hash<point>{}(p) == XXH3_64bits(&p, sizeof(p)));
+
+    // So are arrays of them, in one block.
+    const auto points = std::array<point, 2>{point{1, 2}, point{3, 4}};
+    REQUIRE(xx_hash<std::array<point, 2>>{}(points) ==
+            XXH3_64bits(points.data(), sizeof(points)));
+
+    // Types that may hold pointers are not, their bytes are not their value.
+    STATIC_REQUIRE(
+        !immer_archive::detail::is_hashed_as_bytes_v<std::string_view>);
+    STATIC_REQUIRE(!immer_archive::detail::is_hashed_as_bytes_v<named_point>);
+    STATIC_REQUIRE(!immer_archive::detail::is_hashed_as_bytes_v<const int*>);
+
+    SECTION("Floating point numbers are hashed as their bits")
+    {
+        const auto bits =
+            std::array<unsigned char, 8>{0, 0, 0, 0, 0, 0, 0xf8, 0x3f};
+        REQUIRE(xx_hash<double>{}(1.5) ==
+                XXH3_64bits(bits.data(), bits.size()));
+        REQUIRE(xx_hash<double>{}(-0.0) == xx_hash<double>{}(0.0));
+        REQUIRE(xx_hash<float>{}(-0.0f) == xx_hash<float>{}(0.0f));
+        REQUIRE(xx_hash<float>{}(1.5f) != xx_hash<float>{}(2.5f));
+    }
+
+    SECTION("Hash many values at once")
+    {
+        const auto keys = std::vector<std::int64_t>{0, 1, -1, 1 << 20, 42};
+        auto hashes     = std::vector<std::size_t>(keys.size());
+        immer_archive::xx_hash_batch(
+            keys.data(), keys.data() + keys.size(), hashes.data());
+        for (auto i = std::size_t{}; i < keys.size(); ++i) {
+            REQUIRE(hashes[i] == xx_hash<std::int64_t>{}(keys[i]));
+        }
+    }
+
+    SECTION("Sets of integers hashed with xxHash are validated when loaded")
+    {
+        using Container = immer::set<int, xx_hash<int>>;
+
+        auto set = Container{};
+        for (int i = 0; i < 200; ++i) {
+            set = std::move(set).insert(i);
+        }
+        const auto [ar, set_id] =
+            immer_archive::champ::save_to_archive(set, {});
+        const auto loaded_archive = test::from_json<
+            immer_archive::champ::container_archive_load<Container>>(
+            test::to_json(ar));
+
+        auto loader = immer_archive::champ::container_loader{loaded_archive};
+        REQUIRE(loader.load(set_id) == set);
+    }
+}
+
 TEST_CASE("Test loading a big map saved on macOS with std::hash", "[.macos]")
 {
     using Container = immer::map<std::string, std::string>;